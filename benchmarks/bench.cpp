@@ -0,0 +1,323 @@
+// Benchmark suite: runs the integrator on standard test integrands for a
+// range of dimensions and correlation structures and writes the figures of
+// merit as JSON (to stdout or the file given with --json).
+//
+//   kakuhen_bench [--json FILE] [--samples N] [--iterations N]
+//                 [--warmup N] [--threads N] [--stratify 0|1]
+//                 [--sampling random|sobol|lattice] [--randomizations N]
+//                 [--accumulation auto|scatter|sort] [--filter SUBSTRING]
+//
+// Per run: the estimate and its error (and the pull against the exact value
+// where known), the wall time per sample and its split into the stages of
+// the integrator's profile (random numbers, grid map, conditional bins,
+// integrand, accumulation: thread time per sample divided by the number of
+// threads; refinement: time per sample of the adapting warm-up
+// iterations), the time per refinement, and variance x CPU time, the
+// figure of merit that is independent of the number of samples.  The
+// suite is built with KAKUHEN_PROFILE for the stage timers.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "integrands.hpp"
+#include "kakuhen/kakuhen.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Config {
+  std::uint64_t samples = 20000;
+  std::size_t iterations = 5;
+  std::size_t warmup = 5;
+  std::size_t threads = 1;
+  bool stratify = false;
+  kakuhen::Sampling sampling = kakuhen::Sampling::random;
+  std::size_t randomizations = kakuhen::Options{}.randomizations;
+  kakuhen::Accumulation accumulation = kakuhen::Accumulation::automatic;
+  std::string filter;
+};
+
+struct Record {
+  std::string integrand;
+  std::size_t dim = 0;
+  std::string structure;
+  double value = 0., error = 0., exact = bench::none, chi2dof = 0.;
+  std::uint64_t samples = 0;
+  double ns_per_sample = 0.;
+  double ns_sampling = 0.;
+  /// time per sample of every `kakuhen::Stage`
+  double ns_stage[kakuhen::n_stages] = {};
+  double us_per_adapt = 0.;
+  double cpu_seconds = 0.;
+};
+
+const char* structure_name(kakuhen::Structure s) {
+  switch (s) {
+    case kakuhen::Structure::chain:
+      return "chain";
+    case kakuhen::Structure::pairs:
+      return "pairs";
+    case kakuhen::Structure::tree:
+      return "tree";
+    case kakuhen::Structure::none:
+      return "vegas";
+  }
+  return "";
+}
+
+double seconds(Clock::duration d) {
+  return std::chrono::duration<double>(d).count();
+}
+
+/// stage times of all threads and the points of a profile
+struct StageTotals {
+  kakuhen::StageTimes times{};
+  std::uint64_t samples = 0;
+};
+
+StageTotals totals(const std::vector<kakuhen::IterationProfile>& profile) {
+  StageTotals t;
+  for (const kakuhen::IterationProfile& it : profile) {
+    t.times += it.total();
+    t.samples += it.n_samples;
+  }
+  return t;
+}
+
+template <std::size_t Dim, typename F>
+Record run(const F& f, kakuhen::Structure structure, const Config& cfg) {
+  kakuhen::Options opts;
+  opts.structure = structure;
+  opts.n_threads = cfg.threads;
+  opts.stratify = cfg.stratify;
+  opts.sampling = cfg.sampling;
+  opts.randomizations = cfg.randomizations;
+  opts.accumulation = cfg.accumulation;
+  kakuhen::Integrator<Dim> integrator(opts);
+
+  const auto fb = [&f](const kakuhen::Batch<Dim, double>& batch,
+                       double* values) {
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      values[i] = f(batch.point(i));
+    }
+  };
+
+  // the refinements of the warm-up are timed in the iterations they end
+  integrator.integrate_batch(fb, cfg.warmup, cfg.samples);
+  const StageTotals warmup = totals(integrator.profile());
+  integrator.clear_result();
+  integrator.clear_profile();
+
+  const std::clock_t c0 = std::clock();
+  const auto t0 = Clock::now();
+  const kakuhen::Result& res =
+      integrator.integrate_batch(fb, cfg.iterations, cfg.samples, false);
+  const Clock::duration t_total = Clock::now() - t0;
+  const double cpu = double(std::clock() - c0) / CLOCKS_PER_SEC;
+  const StageTotals measured = totals(integrator.profile());
+
+  Record r;
+  r.integrand = f.name;
+  r.dim = Dim;
+  r.structure = structure_name(structure);
+  r.value = res.value();
+  r.error = res.error();
+  r.exact = f.exact();
+  r.chi2dof = res.chi2dof();
+  r.samples = res.n_samples();
+  const double n = double(r.samples);
+  r.ns_per_sample = seconds(t_total) / n * 1e9;
+  for (std::size_t s = 0; s < kakuhen::n_stages; ++s) {
+    r.ns_stage[s] = double(measured.times[s].ns) /
+                    double(integrator.n_threads()) / n;
+  }
+  const kakuhen::StageTime& refinement =
+      warmup.times[std::size_t(kakuhen::Stage::refinement)];
+  r.ns_stage[std::size_t(kakuhen::Stage::refinement)] =
+      warmup.samples > 0 ? double(refinement.ns) / double(warmup.samples)
+                         : 0.;
+  r.ns_sampling = r.ns_per_sample -
+                  r.ns_stage[std::size_t(kakuhen::Stage::integrand)];
+  r.us_per_adapt =
+      refinement.calls > 0
+          ? double(refinement.ns) / double(refinement.calls) * 1e-3
+          : 0.;
+  r.cpu_seconds = cpu;
+  return r;
+}
+
+void put_number(std::FILE* out, const char* key, double v) {
+  if (std::isfinite(v)) {
+    std::fprintf(out, "\"%s\": %.10g", key, v);
+  } else {
+    std::fprintf(out, "\"%s\": null", key);
+  }
+}
+
+void write_json(std::FILE* out, const Config& cfg,
+                const std::vector<Record>& records) {
+  static const char* levels[] = {"scalar", "avx2", "avx512"};
+  std::fprintf(out, "{\n  \"benchmark\": \"kakuhen\",\n");
+  std::fprintf(out, "  \"simd\": \"%s\",\n",
+               levels[int(kakuhen::simd::level())]);
+  static const char* samplings[] = {"random", "sobol", "lattice"};
+  static const char* accumulations[] = {"auto", "scatter", "sort"};
+  std::fprintf(out,
+               "  \"config\": {\"samples\": %llu, \"iterations\": %zu, "
+               "\"warmup\": %zu, \"threads\": %zu, \"stratify\": %s, "
+               "\"sampling\": \"%s\", \"randomizations\": %zu, "
+               "\"accumulation\": \"%s\"},\n",
+               static_cast<unsigned long long>(cfg.samples), cfg.iterations,
+               cfg.warmup, cfg.threads, cfg.stratify ? "true" : "false",
+               samplings[int(cfg.sampling)], cfg.randomizations,
+               accumulations[int(cfg.accumulation)]);
+  std::fprintf(out, "  \"results\": [");
+  for (std::size_t i = 0; i < records.size(); ++i) {
+    const Record& r = records[i];
+    std::fprintf(out, "%s\n    {\"integrand\": \"%s\", \"dim\": %zu, ",
+                 i > 0 ? "," : "", r.integrand.c_str(), r.dim);
+    std::fprintf(out, "\"structure\": \"%s\", ", r.structure.c_str());
+    put_number(out, "value", r.value);
+    std::fprintf(out, ", ");
+    put_number(out, "error", r.error);
+    std::fprintf(out, ", ");
+    put_number(out, "exact", r.exact);
+    std::fprintf(out, ", ");
+    put_number(out, "pull", (r.value - r.exact) / r.error);
+    std::fprintf(out, ", ");
+    put_number(out, "chi2dof", r.chi2dof);
+    std::fprintf(out, ", \"samples\": %llu, ",
+                 static_cast<unsigned long long>(r.samples));
+    put_number(out, "ns_per_sample", r.ns_per_sample);
+    std::fprintf(out, ", \"stages\": {");
+    for (std::size_t s = 0; s < kakuhen::n_stages; ++s) {
+      const std::string key =
+          std::string(kakuhen::stage_name(kakuhen::Stage(s))) + "_ns";
+      put_number(out, key.c_str(), r.ns_stage[s]);
+      std::fprintf(out, ", ");
+    }
+    put_number(out, "sampling_ns", r.ns_sampling);
+    std::fprintf(out, ", ");
+    put_number(out, "adapt_us", r.us_per_adapt);
+    std::fprintf(out, "}, ");
+    put_number(out, "cpu_seconds", r.cpu_seconds);
+    std::fprintf(out, ", ");
+    put_number(out, "rel_variance_time",
+               r.error * r.error / (r.value * r.value) * r.cpu_seconds);
+    std::fprintf(out, "}");
+  }
+  std::fprintf(out, "\n  ]\n}\n");
+}
+
+template <std::size_t Dim, typename F>
+void run_all(const F& f, const Config& cfg, std::vector<Record>& records) {
+  const std::string label = std::string(f.name) + "/" + std::to_string(Dim);
+  if (label.find(cfg.filter) == std::string::npos) return;
+  std::fprintf(stderr, "%s\n", label.c_str());
+  records.push_back(run<Dim>(f, kakuhen::Structure::none, cfg));
+  records.push_back(run<Dim>(f, kakuhen::Structure::chain, cfg));
+  if (Dim > 2) records.push_back(run<Dim>(f, kakuhen::Structure::tree, cfg));
+}
+
+template <std::size_t Dim>
+void run_dimension(const Config& cfg, std::vector<Record>& records) {
+  run_all<Dim>(bench::Oscillatory<Dim>{}, cfg, records);
+  run_all<Dim>(bench::ProductPeak<Dim>{}, cfg, records);
+  run_all<Dim>(bench::CornerPeak<Dim>{}, cfg, records);
+  run_all<Dim>(bench::Gaussian<Dim>{}, cfg, records);
+  run_all<Dim>(bench::Continuous<Dim>{}, cfg, records);
+  run_all<Dim>(bench::Discontinuous<Dim>{}, cfg, records);
+  run_all<Dim>(bench::Gaussian<Dim>(50., "gaussian_peak"), cfg, records);
+  run_all<Dim>(bench::Ridge<Dim>{}, cfg, records);
+  run_all<Dim>(bench::BreitWigner<Dim>{}, cfg, records);
+  run_all<Dim>(bench::Annulus<Dim>{}, cfg, records);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config cfg;
+  const char* json = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::fprintf(stderr, "missing value for %s\n", arg.c_str());
+      return 2;
+    }
+    const char* value = argv[++i];
+    if (arg == "--json") {
+      json = value;
+    } else if (arg == "--samples") {
+      cfg.samples = std::strtoull(value, nullptr, 10);
+    } else if (arg == "--iterations") {
+      cfg.iterations = std::strtoul(value, nullptr, 10);
+    } else if (arg == "--warmup") {
+      cfg.warmup = std::strtoul(value, nullptr, 10);
+    } else if (arg == "--threads") {
+      cfg.threads = std::strtoul(value, nullptr, 10);
+    } else if (arg == "--stratify") {
+      cfg.stratify = std::strtoul(value, nullptr, 10) != 0;
+    } else if (arg == "--sampling") {
+      const std::string a = value;
+      if (a == "random") {
+        cfg.sampling = kakuhen::Sampling::random;
+      } else if (a == "sobol") {
+        cfg.sampling = kakuhen::Sampling::sobol;
+      } else if (a == "lattice") {
+        cfg.sampling = kakuhen::Sampling::lattice;
+      } else {
+        std::fprintf(stderr, "unknown sampling %s\n", value);
+        return 2;
+      }
+    } else if (arg == "--randomizations") {
+      cfg.randomizations = std::strtoul(value, nullptr, 10);
+    } else if (arg == "--accumulation") {
+      const std::string a = value;
+      if (a == "auto") {
+        cfg.accumulation = kakuhen::Accumulation::automatic;
+      } else if (a == "scatter") {
+        cfg.accumulation = kakuhen::Accumulation::scatter;
+      } else if (a == "sort") {
+        cfg.accumulation = kakuhen::Accumulation::sort;
+      } else {
+        std::fprintf(stderr, "unknown accumulation %s\n", value);
+        return 2;
+      }
+    } else if (arg == "--filter") {
+      cfg.filter = value;
+    } else {
+      std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+      return 2;
+    }
+  }
+
+  if (cfg.sampling != kakuhen::Sampling::random &&
+      (cfg.stratify || cfg.randomizations < 2)) {
+    std::fprintf(stderr,
+                 "quasi-Monte Carlo sampling needs --stratify 0 and "
+                 "--randomizations 2 or more\n");
+    return 2;
+  }
+
+  std::vector<Record> records;
+  run_dimension<2>(cfg, records);
+  run_dimension<4>(cfg, records);
+  run_dimension<8>(cfg, records);
+  run_dimension<16>(cfg, records);
+  run_dimension<30>(cfg, records);
+
+  std::FILE* out = json ? std::fopen(json, "w") : stdout;
+  if (out == nullptr) {
+    std::perror(json);
+    return 1;
+  }
+  write_json(out, cfg, records);
+  if (out != stdout) std::fclose(out);
+  return 0;
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+
+#include "kakuhen/rng.hpp"
+
+/// Test integrands of the benchmark suite on the unit hypercube.  Every
+/// integrand carries its parameters, is called as `f(x)` and reports its
+/// exact integral where a closed form exists (NaN otherwise).
+namespace bench {
+
+constexpr double pi = 3.14159265358979323846;
+constexpr double none = std::numeric_limits<double>::quiet_NaN();
+
+/// Parameters of the Genz families: `a[i]` (difficulty) drawn from
+/// [0.5, 1.5) and rescaled to a fixed sum or mean, `u[i]` (shift) in [0, 1).
+template <std::size_t Dim>
+struct GenzParams {
+  GenzParams(std::uint64_t seed, double scale, bool fixed_sum) {
+    kakuhen::Xoshiro256pp rng(seed);
+    double sum = 0.;
+    for (std::size_t i = 0; i < Dim; ++i) {
+      a[i] = 0.5 + rng.uniform<double>();
+      u[i] = rng.uniform<double>();
+      sum += a[i];
+    }
+    const double norm = fixed_sum ? scale / sum : scale * Dim / sum;
+    for (double& ai : a) ai *= norm;
+  }
+  std::array<double, Dim> a;
+  std::array<double, Dim> u;
+};
+
+/// Genz oscillatory: cos(2 pi u_1 + sum a_i x_i), sum a_i = 9
+template <std::size_t Dim>
+struct Oscillatory {
+  static constexpr const char* name = "genz_oscillatory";
+  GenzParams<Dim> p{1, 9., true};
+  double operator()(const std::array<double, Dim>& x) const {
+    double arg = 2. * pi * p.u[0];
+    for (std::size_t i = 0; i < Dim; ++i) arg += p.a[i] * x[i];
+    return std::cos(arg);
+  }
+  double exact() const {
+    std::complex<double> z = std::polar(1., 2. * pi * p.u[0]);
+    for (std::size_t i = 0; i < Dim; ++i) {
+      z *= (std::polar(1., p.a[i]) - 1.) / std::complex<double>(0., p.a[i]);
+    }
+    return z.real();
+  }
+};
+
+/// Genz product peak: prod 1 / (a_i^-2 + (x_i - u_i)^2), mean a_i = 7.25
+template <std::size_t Dim>
+struct ProductPeak {
+  static constexpr const char* name = "genz_product_peak";
+  GenzParams<Dim> p{2, 7.25, false};
+  double operator()(const std::array<double, Dim>& x) const {
+    double f = 1.;
+    for (std::size_t i = 0; i < Dim; ++i) {
+      const double t = x[i] - p.u[i];
+      f /= 1. / (p.a[i] * p.a[i]) + t * t;
+    }
+    return f;
+  }
+  double exact() const {
+    double v = 1.;
+    for (std::size_t i = 0; i < Dim; ++i) {
+      v *= p.a[i] *
+           (std::atan(p.a[i] * (1. - p.u[i])) + std::atan(p.a[i] * p.u[i]));
+    }
+    return v;
+  }
+};
+
+/// Genz corner peak: (1 + sum a_i x_i)^-(D + 1), sum a_i = 1.85
+template <std::size_t Dim>
+struct CornerPeak {
+  static constexpr const char* name = "genz_corner_peak";
+  GenzParams<Dim> p{3, 1.85, true};
+  double operator()(const std::array<double, Dim>& x) const {
+    double s = 1.;
+    for (std::size_t i = 0; i < Dim; ++i) s += p.a[i] * x[i];
+    return std::pow(s, -double(Dim + 1));
+  }
+  /// inclusion-exclusion over the corners; cancellation limits it to low D
+  double exact() const {
+    if (Dim > 10) return none;
+    double sum = 0.;
+    for (std::size_t mask = 0; mask < (std::size_t(1) << Dim); ++mask) {
+      double s = 1.;
+      int sign = 1;
+      for (std::size_t i = 0; i < Dim; ++i) {
+        if (mask >> i & 1) {
+          s += p.a[i];
+          sign = -sign;
+        }
+      }
+      sum += sign / s;
+    }
+    double norm = 1.;
+    for (std::size_t i = 0; i < Dim; ++i) norm *= double(i + 1) * p.a[i];
+    return sum / norm;
+  }
+};
+
+/// Genz Gaussian: exp(-sum a_i^2 (x_i - u_i)^2), mean a_i = `width`
+template <std::size_t Dim>
+struct Gaussian {
+  explicit Gaussian(double width = 7.03, const char* label = "genz_gaussian")
+      : p(4, width, false), name(label) {}
+  GenzParams<Dim> p;
+  const char* name;
+  double operator()(const std::array<double, Dim>& x) const {
+    double arg = 0.;
+    for (std::size_t i = 0; i < Dim; ++i) {
+      const double t = p.a[i] * (x[i] - p.u[i]);
+      arg += t * t;
+    }
+    return std::exp(-arg);
+  }
+  double exact() const {
+    double v = 1.;
+    for (std::size_t i = 0; i < Dim; ++i) {
+      v *= std::sqrt(pi) / (2. * p.a[i]) *
+           (std::erf(p.a[i] * (1. - p.u[i])) + std::erf(p.a[i] * p.u[i]));
+    }
+    return v;
+  }
+};
+
+/// Genz C0 function: exp(-sum a_i |x_i - u_i|), mean a_i = 20.4
+template <std::size_t Dim>
+struct Continuous {
+  static constexpr const char* name = "genz_continuous";
+  GenzParams<Dim> p{5, 20.4, false};
+  double operator()(const std::array<double, Dim>& x) const {
+    double arg = 0.;
+    for (std::size_t i = 0; i < Dim; ++i) arg += p.a[i] * std::abs(x[i] - p.u[i]);
+    return std::exp(-arg);
+  }
+  double exact() const {
+    double v = 1.;
+    for (std::size_t i = 0; i < Dim; ++i) {
+      v *= (2. - std::exp(-p.a[i] * p.u[i]) -
+            std::exp(-p.a[i] * (1. - p.u[i]))) /
+           p.a[i];
+    }
+    return v;
+  }
+};
+
+/// Genz discontinuous: exp(sum a_i x_i) for x_1 < u_1, x_2 < u_2, else 0;
+/// sum a_i = 4.3
+template <std::size_t Dim>
+struct Discontinuous {
+  static constexpr const char* name = "genz_discontinuous";
+  GenzParams<Dim> p{6, 4.3, true};
+  double operator()(const std::array<double, Dim>& x) const {
+    for (std::size_t i = 0; i < Dim && i < 2; ++i) {
+      if (x[i] > p.u[i]) return 0.;
+    }
+    double arg = 0.;
+    for (std::size_t i = 0; i < Dim; ++i) arg += p.a[i] * x[i];
+    return std::exp(arg);
+  }
+  double exact() const {
+    double v = 1.;
+    for (std::size_t i = 0; i < Dim; ++i) {
+      const double hi = i < 2 ? p.u[i] : 1.;
+      v *= std::expm1(p.a[i] * hi) / p.a[i];
+    }
+    return v;
+  }
+};
+
+/// Gaussian ridges along the diagonals x_d = x_(d-1) of width 0.05: the
+/// case the two-point tables are made for
+template <std::size_t Dim>
+struct Ridge {
+  static constexpr const char* name = "diagonal_ridge";
+  double operator()(const std::array<double, Dim>& x) const {
+    double arg = 0.;
+    for (std::size_t d = 1; d < Dim; ++d) {
+      const double t = (x[d] - x[d - 1]) / 0.05;
+      arg += t * t;
+    }
+    return std::exp(-0.5 * arg);
+  }
+  double exact() const { return none; }
+};
+
+/// Breit-Wigner resonances of mass 1 and width 0.02 in the sums
+/// x_(2k) + x_(2k+1) of pairs of dimensions
+template <std::size_t Dim>
+struct BreitWigner {
+  static constexpr const char* name = "breit_wigner";
+  static constexpr double mass = 1.;
+  static constexpr double half_width = 0.01;
+  double operator()(const std::array<double, Dim>& x) const {
+    double f = 1.;
+    for (std::size_t d = 1; d < Dim; d += 2) {
+      const double t = x[d - 1] + x[d] - mass;
+      f *= half_width / (t * t + half_width * half_width);
+    }
+    return f;
+  }
+  /// per pair: integral over s of the resonance times the triangular
+  /// density of s = x + y
+  double exact() const {
+    const double m = mass, c = half_width;
+    // antiderivatives of c g(s) and c s g(s) with g = 1 / ((s - m)^2 + c^2)
+    const auto G = [=](double s) { return std::atan((s - m) / c); };
+    const auto S = [=](double s) {
+      return 0.5 * c * std::log((s - m) * (s - m) + c * c) + m * G(s);
+    };
+    const double pair = (S(1.) - S(0.)) + 2. * (G(2.) - G(1.)) - (S(2.) - S(1.));
+    return std::pow(pair, double(Dim / 2));
+  }
+};
+
+/// spherical shell of radius 0.3 and width 0.02 around the centre
+template <std::size_t Dim>
+struct Annulus {
+  static constexpr const char* name = "annulus";
+  double operator()(const std::array<double, Dim>& x) const {
+    double r2 = 0.;
+    for (std::size_t d = 0; d < Dim; ++d) r2 += (x[d] - 0.5) * (x[d] - 0.5);
+    const double t = (std::sqrt(r2) - 0.3) / 0.02;
+    return std::exp(-0.5 * t * t);
+  }
+  double exact() const { return none; }
+};
+
+}  // namespace bench
@@ -0,0 +1,27 @@
+#include <cmath>
+#include <cstdio>
+
+#include "kakuhen/kakuhen.hpp"
+
+int main() {
+  // narrow Gaussian ridge along the diagonal of the unit square, repeated for
+  // neighbouring pairs of dimensions: a case where the two-point tables help
+  constexpr std::size_t dim = 4;
+  const auto ridge = [](const std::array<double, dim>& x) {
+    double arg = 0.;
+    for (std::size_t d = 1; d < dim; ++d) {
+      const double t = (x[d] - x[d - 1]) / 0.05;
+      arg += t * t;
+    }
+    return std::exp(-0.5 * arg);
+  };
+
+  kakuhen::Integrator<dim> integrator;
+  integrator.integrate(ridge, 10, 20000);  // warm-up
+  integrator.clear_result();
+  const auto& res = integrator.integrate(ridge, 10, 100000, false);
+
+  std::printf("integral = %.8e +- %.2e  (chi2/dof = %.2f)\n", res.value(),
+              res.error(), res.chi2dof());
+  return 0;
+}
@@ -0,0 +1,30 @@
+#include <cstdio>
+#include <exception>
+
+#include "kakuhen/snapshot.hpp"
+
+// Merge the snapshots of independent runs off the same grid:
+//
+//   kakuhen_merge merged.snap job1.snap job2.snap ...
+//
+// The merged snapshot is fed to `Integrator::adapt(const Snapshot&)` to
+// refine the grid from the samples of all runs.
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::fprintf(stderr, "usage: %s <output> <snapshot>...\n", argv[0]);
+    return 2;
+  }
+  try {
+    kakuhen::Snapshot merged = kakuhen::Snapshot::load(argv[2]);
+    for (int i = 3; i < argc; ++i) merged += kakuhen::Snapshot::load(argv[i]);
+    merged.save(argv[1]);
+    const kakuhen::Estimate est = merged.estimate();
+    std::printf("%d snapshots, %llu samples: %.8e +- %.2e\n", argc - 2,
+                static_cast<unsigned long long>(est.n_samples), est.value,
+                est.error);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,75 @@
+#include <cmath>
+#include <cstdio>
+
+#include "kakuhen/kakuhen.hpp"
+
+// Two narrow Breit-Wigner resonances in different variables: a sum that no
+// product density samples well, but each term is flattened by its own
+// channel mapping.
+constexpr std::size_t dim = 3;
+using point = std::array<double, dim>;
+
+struct Resonance {
+  std::size_t var;
+  double mass, width;
+
+  double operator()(double x) const {
+    const double t = x - mass;
+    return width / (t * t + width * width);
+  }
+  double lo() const { return std::atan(-mass / width); }
+  double hi() const { return std::atan((1. - mass) / width); }
+};
+
+const Resonance peaks[2] = {{0, 0.3, 0.002}, {1, 0.6, 0.005}};
+
+/// channel i: the Cauchy map x = mass + width tan(.) in the variable of
+/// peak i, which turns the resonance flat; all other variables unchanged
+struct Mappings {
+  std::size_t size() const { return 2; }
+
+  double map(std::size_t i, const point& y, point& x) const {
+    const Resonance& r = peaks[i];
+    x = y;
+    const double range = r.hi() - r.lo();
+    x[r.var] = r.mass + r.width * std::tan(r.lo() + y[r.var] * range);
+    return range / r(x[r.var]);
+  }
+  double inverse(std::size_t i, const point& x, point& y) const {
+    const Resonance& r = peaks[i];
+    y = x;
+    const double range = r.hi() - r.lo();
+    y[r.var] = (std::atan((x[r.var] - r.mass) / r.width) - r.lo()) / range;
+    return r(x[r.var]) / range;
+  }
+};
+
+int main() {
+  const auto f = [](const point& x) {
+    return peaks[0](x[0]) * (1. + x[2]) + peaks[1](x[1]) * x[2];
+  };
+  const double exact = 1.5 * (peaks[0].hi() - peaks[0].lo()) +
+                       0.5 * (peaks[1].hi() - peaks[1].lo());
+
+  kakuhen::Integrator<dim> single;
+  single.integrate(f, 10, 20000);
+  single.clear_result();
+  const auto& r1 = single.integrate(f, 10, 100000, false);
+
+  // each mapping leaves a flat, uncorrelated integrand in its channel
+  kakuhen::Options opts;
+  opts.structure = kakuhen::Structure::none;
+  kakuhen::MultiChannel<dim, Mappings> multi(Mappings{}, opts);
+  multi.integrate(f, 10, 20000);
+  multi.clear_result();
+  const auto& r2 = multi.integrate(f, 10, 100000, false);
+
+  std::printf("exact          = %.8e\n", exact);
+  std::printf("single channel = %.8e +- %.2e  (chi2/dof = %.2f)\n", r1.value(),
+              r1.error(), r1.chi2dof());
+  std::printf("two channels   = %.8e +- %.2e  (chi2/dof = %.2f), "
+              "alpha = %.3f %.3f\n",
+              r2.value(), r2.error(), r2.chi2dof(), multi.alpha(0),
+              multi.alpha(1));
+  return 0;
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace kakuhen {
+
+/// Conversion of non-negative importance values to 64-bit fixed point.
+///
+/// Integer addition is associative, so refinement histograms filled with
+/// quantised values are bit-identical however the samples are distributed
+/// over threads and in which order the partial histograms are merged.  The
+/// unit is chosen relative to the mean importance (see `Integrator`), values
+/// below half a unit are dropped and the sums saturate instead of wrapping.
+class Quantizer {
+ public:
+  using value_type = std::uint64_t;
+
+  /// `unit` is the value of one count; non-positive units fall back to 1
+  explicit Quantizer(double unit = 1.) noexcept { set_unit(unit); }
+
+  void set_unit(double unit) noexcept {
+    unit_ = (unit > 0. && std::isfinite(unit)) ? unit : 1.;
+    inv_unit_ = 1. / unit_;
+  }
+  double unit() const noexcept { return unit_; }
+
+  value_type quantize(double v) const noexcept {
+    const double q = v * inv_unit_ + 0.5;
+    return q < max_exact ? value_type(q) : value_type(max_exact);
+  }
+
+  double value(value_type q) const noexcept { return double(q) * unit_; }
+
+  static value_type add(value_type a, value_type b) noexcept {
+    const value_type s = a + b;
+    return s < a ? std::numeric_limits<value_type>::max() : s;
+  }
+
+ private:
+  /// single contributions are capped at 2^62 counts
+  static constexpr double max_exact = 4611686018427387904.;
+
+  double unit_ = 1.;
+  double inv_unit_ = 1.;
+};
+
+/// Histogram of quantised values that stores only the cells it was filled
+/// in: an open-addressing hash table (linear probing) from the cell index to
+/// the count.  It grows when it becomes half full, which only happens while
+/// an iteration touches more cells than any before.
+class SparseHistogram {
+ public:
+  using value_type = Quantizer::value_type;
+
+  explicit SparseHistogram(std::size_t capacity = 64) {
+    std::size_t cap = 16;
+    while (cap < 2 * capacity) cap *= 2;
+    keys_.assign(cap, empty);
+    values_.assign(cap, 0);
+  }
+
+  std::size_t size() const noexcept { return size_; }
+  std::size_t capacity() const noexcept { return keys_.size(); }
+  /// heap memory in bytes
+  std::size_t memory() const noexcept {
+    return keys_.size() * (sizeof(std::uint32_t) + sizeof(value_type));
+  }
+
+  void clear() noexcept {
+    if (size_ == 0) return;
+    std::fill(keys_.begin(), keys_.end(), empty);
+    size_ = 0;
+  }
+
+  void add(std::uint32_t cell, value_type v) {
+    if (2 * (size_ + 1) > keys_.size()) grow();
+    const std::size_t mask = keys_.size() - 1;
+    for (std::size_t h = hash(cell) & mask;; h = (h + 1) & mask) {
+      if (keys_[h] == cell) {
+        values_[h] = Quantizer::add(values_[h], v);
+        return;
+      }
+      if (keys_[h] == empty) {
+        keys_[h] = cell;
+        values_[h] = v;
+        ++size_;
+        return;
+      }
+    }
+  }
+
+  /// call `f(cell, count)` for every filled cell, in unspecified order
+  template <typename F>
+  void for_each(F&& f) const {
+    for (std::size_t h = 0; h < keys_.size(); ++h) {
+      if (keys_[h] != empty) f(keys_[h], values_[h]);
+    }
+  }
+
+ private:
+  static constexpr std::uint32_t empty = ~std::uint32_t(0);
+
+  static std::size_t hash(std::uint32_t cell) noexcept {
+    // Fibonacci hashing; the high bits are the best mixed
+    return std::size_t((std::uint64_t(cell) * 0x9E3779B97F4A7C15ULL) >> 32);
+  }
+
+  void grow() {
+    std::vector<std::uint32_t> keys(2 * keys_.size(), empty);
+    std::vector<value_type> values(keys.size(), 0);
+    keys.swap(keys_);
+    values.swap(values_);
+    size_ = 0;
+    for (std::size_t h = 0; h < keys.size(); ++h) {
+      if (keys[h] != empty) add(keys[h], values[h]);
+    }
+  }
+
+  std::vector<std::uint32_t> keys_;
+  std::vector<value_type> values_;
+  std::size_t size_ = 0;
+};
+
+/// Sort the first `n` cells of `keys` together with their `values` by
+/// increasing cell: stable LSD radix sort in two passes over the lowest
+/// `key_bits` bits, with `tmp_keys` and `tmp_values` (of at least `n`
+/// elements) as scratch that is swapped with the inputs after every pass
+/// and `start` as the bucket offsets.
+inline void radix_sort(std::vector<std::uint32_t>& keys,
+                       std::vector<Quantizer::value_type>& values,
+                       std::vector<std::uint32_t>& tmp_keys,
+                       std::vector<Quantizer::value_type>& tmp_values,
+                       std::vector<std::size_t>& start, std::size_t n,
+                       unsigned key_bits) {
+  const unsigned digit_bits = (key_bits + 1) / 2;
+  const std::uint32_t mask = (std::uint32_t(1) << digit_bits) - 1;
+  for (unsigned shift = 0; shift < 2 * digit_bits; shift += digit_bits) {
+    start.assign(std::size_t(mask) + 1, 0);
+    for (std::size_t i = 0; i < n; ++i) ++start[(keys[i] >> shift) & mask];
+    std::size_t sum = 0;
+    for (std::size_t& s : start) {
+      const std::size_t c = s;
+      s = sum;
+      sum += c;
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+      const std::size_t k = start[(keys[i] >> shift) & mask]++;
+      tmp_keys[k] = keys[i];
+      tmp_values[k] = values[i];
+    }
+    keys.swap(tmp_keys);
+    values.swap(tmp_values);
+  }
+}
+
+/// Refinement histograms of one worker: the importance per 1D bin
+/// `[dim][bin]` and per cell of the two-point tables (packed as described
+/// by `PairLayout`).  The pair cells are either a dense array or, with
+/// `sparse_pairs`, a `SparseHistogram` holding only the cells that were filled,
+/// which saves memory and cache traffic when an iteration samples far fewer
+/// points per worker than there are pair cells.
+struct Accumulator {
+  Accumulator(std::size_t n_one, std::size_t n_pair, bool sparse_pairs = false)
+      : one(n_one, 0),
+        pair(sparse_pairs ? 0 : n_pair, 0),
+        sparse_pair(sparse_pairs ? 1024 : 0),
+        sparse(sparse_pairs) {}
+
+  void clear() noexcept {
+    std::fill(one.begin(), one.end(), 0);
+    std::fill(pair.begin(), pair.end(), 0);
+    sparse_pair.clear();
+  }
+
+  /// add `v` to the pair cell `cell`
+  void add_pair(std::uint32_t cell, Quantizer::value_type v) {
+    if (sparse) {
+      sparse_pair.add(cell, v);
+    } else {
+      pair[cell] = Quantizer::add(pair[cell], v);
+    }
+  }
+
+  /// add the counts of `other`, dense or sparse
+  Accumulator& operator+=(const Accumulator& other) {
+    for (std::size_t i = 0; i < one.size(); ++i) {
+      one[i] = Quantizer::add(one[i], other.one[i]);
+    }
+    if (!sparse && !other.sparse) {
+      for (std::size_t i = 0; i < pair.size(); ++i) {
+        pair[i] = Quantizer::add(pair[i], other.pair[i]);
+      }
+    } else {
+      other.for_each_pair([this](std::uint32_t cell, Quantizer::value_type v) {
+        add_pair(cell, v);
+      });
+    }
+    return *this;
+  }
+
+  /// call `f(cell, count)` for every non-empty pair cell
+  template <typename F>
+  void for_each_pair(F&& f) const {
+    if (!sparse) {
+      for (std::size_t i = 0; i < pair.size(); ++i) {
+        if (pair[i] != 0) f(std::uint32_t(i), pair[i]);
+      }
+    } else {
+      sparse_pair.for_each(f);
+    }
+  }
+
+  std::vector<Quantizer::value_type> one;
+  std::vector<Quantizer::value_type> pair;
+  SparseHistogram sparse_pair;
+  bool sparse;
+};
+
+}  // namespace kakuhen
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kakuhen {
+
+/// Block of sample points in structure-of-arrays layout.
+///
+/// Coordinates, bin indices and weights are stored contiguously per
+/// dimension so that integrands can vectorise across the points of a block:
+/// `x(d)[i]` is coordinate `d` of point `i`, `weight()[i]` its Jacobian
+/// weight (inverse sampling density) and `bin(d)[i]` the grid bin it was
+/// drawn from in dimension `d`.
+template <std::size_t Dim, typename Float>
+class Batch {
+ public:
+  using float_type = Float;
+  using bin_type = std::uint32_t;
+  using point_type = std::array<Float, Dim>;
+
+  static constexpr std::size_t dimension = Dim;
+
+  explicit Batch(std::size_t capacity = 0)
+      : capacity_(capacity),
+        x_(Dim * capacity),
+        bin_(Dim * capacity),
+        weight_(capacity) {}
+
+  std::size_t capacity() const noexcept { return capacity_; }
+  std::size_t size() const noexcept { return size_; }
+
+  const Float* x(std::size_t d) const noexcept {
+    return x_.data() + d * capacity_;
+  }
+  Float x(std::size_t d, std::size_t i) const noexcept {
+    return x_[d * capacity_ + i];
+  }
+  const bin_type* bin(std::size_t d) const noexcept {
+    return bin_.data() + d * capacity_;
+  }
+  const Float* weight() const noexcept { return weight_.data(); }
+
+  /// gather the coordinates of point `i`
+  point_type point(std::size_t i) const noexcept {
+    point_type p;
+    for (std::size_t d = 0; d < Dim; ++d) p[d] = x_[d * capacity_ + i];
+    return p;
+  }
+
+  /// mutable access for the sampler filling the block
+  void resize(std::size_t n) noexcept {
+    assert(n <= capacity_);
+    size_ = n;
+  }
+  Float* x(std::size_t d) noexcept { return x_.data() + d * capacity_; }
+  bin_type* bin(std::size_t d) noexcept { return bin_.data() + d * capacity_; }
+  Float* weight() noexcept { return weight_.data(); }
+
+ private:
+  std::size_t capacity_;
+  std::size_t size_ = 0;
+  std::vector<Float> x_;
+  std::vector<bin_type> bin_;
+  std::vector<Float> weight_;
+};
+
+}  // namespace kakuhen
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "kakuhen/grid_file.hpp"
+#include "kakuhen/result.hpp"
+#include "kakuhen/sketch.hpp"
+
+namespace kakuhen {
+
+/// Complete state of an `Integrator` (see `Integrator::checkpoint`), from
+/// which an integrator constructed with the same options continues
+/// bit-identically: the density, the refinement data since the last
+/// refinement, the combination of the iterations, the finished chunks of
+/// an iteration in progress and the progress of `Integrator::run`.  The
+/// random streams are addressed by (seed, iteration, chunk), so the
+/// iteration and the finished chunks are all their state.
+///
+/// The binary form (`write`, `read`) is a fixed header followed by the
+/// payload in the byte order of the writing machine; the header holds the
+/// `grid_file::checksum` of the payload.  Floating-point numbers of the
+/// density are stored as double, which holds a float exactly.
+struct Checkpoint {
+  /// options the state belongs to
+  std::uint32_t dimension = 0;
+  std::uint32_t n_bins = 0;
+  std::uint32_t float_size = 0;
+  std::uint32_t structure = 0;
+  std::uint64_t seed = 0;
+  std::uint64_t chunk_size = 0;
+  std::uint64_t batch_size = 0;
+  std::uint32_t stratify = 0;
+  /// source of the uniform numbers (`Sampling`) and randomisations of the
+  /// quasi-Monte Carlo points (0: pseudo-random points)
+  std::uint32_t sampling = 0;
+  std::uint32_t randomizations = 0;
+  /// defensive mixture (`Options::defensive`, `defensive_density` and
+  /// `defensive_adapt`) and storage of the pair histograms
+  double defensive = 0.;
+  std::uint32_t defensive_density = 0;
+  std::uint32_t defensive_adapt = 0;
+  std::uint32_t sparse_pairs = 0;
+
+  /// stored pairs (i0, j0, i1, j1, ...), parents (`grid_file::npos`:
+  /// none), grid edges [dim][n_bins + 1] and conditional tables (see
+  /// `PairLayout`)
+  std::vector<std::uint32_t> pairs;
+  std::vector<std::uint32_t> parents;
+  std::vector<double> edges;
+  std::vector<double> tables;
+  std::uint64_t refinements = 0;
+  /// iterations run (the one in progress included) and whether the
+  /// histogram unit is fixed, and which
+  std::uint64_t iteration = 0;
+  std::uint32_t calibrated = 0;
+  double unit = 1.;
+  /// fraction of the defensive mixture and the second moments of its
+  /// candidates since the last refinement
+  double mix = 0.;
+  std::vector<double> pending_mix;
+  /// strata per dimension, allocation weights and variances
+  std::uint64_t n_strata = 1;
+  std::vector<double> strata_weight;
+  std::vector<double> strata_var;
+
+  /// refinement data since the last refinement: sums, fixed-point
+  /// histograms (the filled pair cells and their counts) and the weight
+  /// sketch, and whether it records (`Options::weight_sketch`)
+  Sums pending;
+  std::vector<std::uint64_t> one;
+  std::vector<std::uint32_t> pair_cells;
+  std::vector<std::uint64_t> pair_counts;
+  WeightSketch weights;
+  std::uint32_t weight_sketch = 0;
+  Result result;
+
+  /// iteration in progress (`n_samples == 0`: none): the finished chunks
+  /// with their sums, mixture moments and partial sums per hypercube
+  std::uint64_t n_samples = 0;
+  std::vector<std::uint8_t> done;
+  std::vector<Sums> chunk_sums;
+  std::vector<double> chunk_mix;
+  std::vector<Sums> cube_partials;
+
+  /// `Integrator::run` in progress (`run_active == 0`: none): points of
+  /// the current iteration, variance per point of the previous one and
+  /// the totals so far
+  std::uint32_t run_active = 0;
+  std::uint64_t run_n = 0;
+  double run_previous = 0.;
+  std::uint64_t run_iterations = 0;
+  std::uint64_t run_samples = 0;
+  double run_wall = 0.;
+  double run_cpu = 0.;
+
+  void write(std::ostream& out) const {
+    std::ostringstream body(std::ios::binary);
+    put(body, dimension, n_bins, float_size, structure, seed, chunk_size,
+        batch_size, stratify, sampling, randomizations, defensive,
+        defensive_density, defensive_adapt, sparse_pairs);
+    put_vector(body, pairs);
+    put_vector(body, parents);
+    put_vector(body, edges);
+    put_vector(body, tables);
+    put(body, refinements, iteration, calibrated, unit, mix);
+    put_vector(body, pending_mix);
+    put(body, n_strata);
+    put_vector(body, strata_weight);
+    put_vector(body, strata_var);
+    put(body, pending);
+    put_vector(body, one);
+    put_vector(body, pair_cells);
+    put_vector(body, pair_counts);
+    weights.write(body);
+    put(body, weight_sketch);
+    result.write(body);
+    put(body, n_samples);
+    put_vector(body, done);
+    put_vector(body, chunk_sums);
+    put_vector(body, chunk_mix);
+    put_vector(body, cube_partials);
+    put(body, run_active, run_n, run_previous, run_iterations, run_samples,
+        run_wall, run_cpu);
+
+    const std::string payload = body.str();
+    Header h{};
+    std::memcpy(h.magic, magic, sizeof h.magic);
+    h.version = version;
+    h.byte_order = grid_file::byte_order;
+    h.payload_size = payload.size();
+    h.checksum = grid_file::checksum(payload.data(), payload.size());
+    out.write(reinterpret_cast<const char*>(&h), sizeof h);
+    out.write(payload.data(), std::streamsize(payload.size()));
+  }
+
+  /// throws `std::runtime_error` on a malformed, truncated or corrupt
+  /// stream
+  static Checkpoint read(std::istream& in) {
+    Header h;
+    if (!in.read(reinterpret_cast<char*>(&h), sizeof h) ||
+        std::memcmp(h.magic, magic, sizeof h.magic) != 0) {
+      fail("not a checkpoint");
+    }
+    if (h.version != version) fail("unsupported version");
+    if (h.byte_order != grid_file::byte_order) fail("wrong byte order");
+    // a corrupt size must not allocate beyond the stream
+    if (h.payload_size > max_payload || h.payload_size > remaining(in)) {
+      fail("truncated checkpoint");
+    }
+    std::string payload(std::size_t(h.payload_size), '\0');
+    if (!in.read(payload.data(), std::streamsize(payload.size()))) {
+      fail("truncated checkpoint");
+    }
+    if (grid_file::checksum(payload.data(), payload.size()) != h.checksum) {
+      fail("checksum mismatch");
+    }
+
+    std::istringstream body(std::move(payload), std::ios::binary);
+    Checkpoint c;
+    get(body, c.dimension, c.n_bins, c.float_size, c.structure, c.seed,
+        c.chunk_size, c.batch_size, c.stratify, c.sampling,
+        c.randomizations, c.defensive, c.defensive_density,
+        c.defensive_adapt, c.sparse_pairs);
+    get_vector(body, c.pairs);
+    get_vector(body, c.parents);
+    get_vector(body, c.edges);
+    get_vector(body, c.tables);
+    get(body, c.refinements, c.iteration, c.calibrated, c.unit, c.mix);
+    get_vector(body, c.pending_mix);
+    get(body, c.n_strata);
+    get_vector(body, c.strata_weight);
+    get_vector(body, c.strata_var);
+    get(body, c.pending);
+    get_vector(body, c.one);
+    get_vector(body, c.pair_cells);
+    get_vector(body, c.pair_counts);
+    c.weights.read(body);
+    get(body, c.weight_sketch);
+    c.result.read(body);
+    get(body, c.n_samples);
+    get_vector(body, c.done);
+    get_vector(body, c.chunk_sums);
+    get_vector(body, c.chunk_mix);
+    get_vector(body, c.cube_partials);
+    get(body, c.run_active, c.run_n, c.run_previous, c.run_iterations,
+        c.run_samples, c.run_wall, c.run_cpu);
+    if (!body) fail("truncated checkpoint");
+    return c;
+  }
+
+  /// Write the checkpoint to `path` atomically: to `path + ".tmp"`, which
+  /// is synced to the disk and renamed, and the directory is synced after
+  /// the rename, so that `path` holds either the previous or the new
+  /// checkpoint whenever the process or the machine goes down.  Throws
+  /// `std::system_error` if the file cannot be written.
+  void save(const std::string& path) const {
+    const std::string tmp = path + ".tmp";
+    {
+      std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+      if (out) write(out);
+      if (!out.flush()) error("kakuhen::Checkpoint::save: " + tmp);
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    const int fd = ::open(tmp.c_str(), O_RDONLY);
+    const bool synced = fd >= 0 && ::fsync(fd) == 0;
+    if (fd >= 0) ::close(fd);
+    if (!synced) error("kakuhen::Checkpoint::save: " + tmp);
+#endif
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+      error("kakuhen::Checkpoint::save: " + path);
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    // the rename is durable only once the directory entry is (some file
+    // systems cannot sync a directory and say so with EINVAL)
+    const std::size_t slash = path.find_last_of('/');
+    const std::string dir = slash == std::string::npos ? std::string(".")
+                            : slash == 0               ? std::string("/")
+                                                       : path.substr(0, slash);
+    const int dfd = ::open(dir.c_str(), O_RDONLY);
+    const bool dir_synced =
+        dfd >= 0 && (::fsync(dfd) == 0 || errno == EINVAL);
+    if (dfd >= 0) ::close(dfd);
+    if (!dir_synced) error("kakuhen::Checkpoint::save: " + dir);
+#endif
+  }
+
+  /// throws `std::system_error` if the file cannot be opened
+  static Checkpoint load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) error("kakuhen::Checkpoint::load: " + path);
+    return read(in);
+  }
+
+ private:
+  static constexpr char magic[8] = {'K', 'A', 'K', 'U', 'C', 'K', 'P', 'T'};
+  static constexpr std::uint32_t version = 5;
+  /// bound on the payload and on each of its vectors in bytes
+  static constexpr std::uint64_t max_payload = std::uint64_t(1) << 40;
+
+  struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t payload_size;
+    std::uint64_t checksum;
+  };
+
+  template <typename... T>
+  static void put(std::ostream& out, const T&... v) {
+    (out.write(reinterpret_cast<const char*>(&v), sizeof v), ...);
+  }
+
+  template <typename T>
+  static void put_vector(std::ostream& out, const std::vector<T>& v) {
+    const std::uint64_t n = v.size();
+    put(out, n);
+    out.write(reinterpret_cast<const char*>(v.data()),
+              std::streamsize(n * sizeof(T)));
+  }
+
+  template <typename... T>
+  static void get(std::istream& in, T&... v) {
+    (in.read(reinterpret_cast<char*>(&v), sizeof v), ...);
+  }
+
+  template <typename T>
+  static void get_vector(std::istream& in, std::vector<T>& v) {
+    std::uint64_t n = 0;
+    get(in, n);
+    // a corrupt length must not allocate beyond the payload
+    if (!in || n > max_payload / sizeof(T)) {
+      in.setstate(std::ios::failbit);
+      return;
+    }
+    v.resize(std::size_t(n));
+    in.read(reinterpret_cast<char*>(v.data()), std::streamsize(n * sizeof(T)));
+  }
+
+  /// bytes left in `in`, or the largest payload if it cannot seek
+  static std::uint64_t remaining(std::istream& in) {
+    const std::istream::pos_type pos = in.tellg();
+    if (pos == std::istream::pos_type(-1)) return max_payload;
+    const std::istream::pos_type end = in.seekg(0, std::ios::end).tellg();
+    in.clear();
+    in.seekg(pos);
+    if (end == std::istream::pos_type(-1) || end < pos) return max_payload;
+    return std::uint64_t(end - pos);
+  }
+
+  [[noreturn]] static void fail(const char* what) {
+    throw std::runtime_error(std::string("kakuhen::Checkpoint: ") + what);
+  }
+
+  [[noreturn]] static void error(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+  }
+};
+
+}  // namespace kakuhen
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kakuhen {
+
+/// Stopping criteria and growth of the iterations of `Integrator::run`.
+/// Every criterion is off at 0; at least one must be set.
+struct RunControl {
+  /// stop once the combined result has at most this relative error
+  double rel_error = 0.;
+  /// stop once this wall-clock time in seconds has passed
+  double wall_time = 0.;
+  /// stop once the threads have been busy evaluating chunks for this many
+  /// seconds in total
+  double cpu_time = 0.;
+  /// stop after this many iterations
+  std::size_t max_iterations = 0;
+  /// points of the first iteration, and the most of any iteration (0: no
+  /// limit)
+  std::uint64_t n_samples = 10000;
+  std::uint64_t max_samples = 0;
+  /// Once an iteration lowers the variance per point by less than the
+  /// fraction `convergence` of the previous one, the grid counts as
+  /// converged and the points per iteration are multiplied by `growth`,
+  /// but not beyond the points expected to reach `rel_error`.
+  double growth = 2.;
+  double convergence = 0.1;
+  /// iterations combined in the result before `rel_error` is trusted
+  std::size_t min_iterations = 2;
+  /// refine the grids and tables after every complete iteration
+  bool adapt = true;
+};
+
+/// Why `Integrator::run` stopped.
+enum class Stop {
+  rel_error,
+  wall_time,
+  cpu_time,
+  max_iterations,
+};
+
+/// Summary of `Integrator::run`; the estimate is in `Integrator::result`.
+struct RunReport {
+  Stop reason = Stop::max_iterations;
+  std::size_t n_iterations = 0;
+  std::uint64_t n_samples = 0;
+  /// the last iteration was cut short by the stop
+  bool truncated = false;
+  /// seconds of wall-clock time and of busy time summed over the threads
+  double wall_time = 0.;
+  double cpu_time = 0.;
+};
+
+}  // namespace kakuhen
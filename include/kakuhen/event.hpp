@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "kakuhen/result.hpp"
+
+namespace kakuhen {
+
+/// Unweighted event: a point accepted by hit-or-miss unweighting and its
+/// weight, +-max_weight or, for an overweight point (|f w| > max_weight),
+/// its full weight f w.
+template <std::size_t Dim, typename Float>
+struct Event {
+  std::array<Float, Dim> x;
+  Float weight;
+};
+
+/// Summary of an unweighting run (see `Integrator::unweight`).
+struct Unweighting {
+  /// estimate of the integral from all trials
+  Estimate estimate;
+  double max_weight = 0.;
+  std::uint64_t trials = 0;
+  std::uint64_t accepted = 0;
+  /// accepted events whose |f w| exceeded `max_weight`
+  std::uint64_t overweight = 0;
+
+  /// accepted events per trial
+  double efficiency() const noexcept {
+    return trials > 0 ? double(accepted) / double(trials) : 0.;
+  }
+};
+
+}  // namespace kakuhen
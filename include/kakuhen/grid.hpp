@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kakuhen {
+
+/// Adaptive one-dimensional grid on [0, 1].
+///
+/// The `n_bins` bins have equal a-priori sampling probability and adjustable
+/// widths, i.e. the piecewise-linear VEGAS map.  Edges are moved by `refine`
+/// so that each bin ends up carrying the same share of the (damped)
+/// importance that was accumulated during an iteration.
+template <typename Float>
+class Grid {
+ public:
+  explicit Grid(std::size_t n_bins = 64)
+      : edges_(n_bins + 1),
+        widths_(n_bins),
+        scratch_(n_bins + 1),
+        rebin_(n_bins) {
+    assert(n_bins > 0);
+    for (std::size_t i = 0; i <= n_bins; ++i) {
+      edges_[i] = Float(i) / Float(n_bins);
+    }
+    update_widths();
+  }
+
+  std::size_t n_bins() const noexcept { return widths_.size(); }
+
+  /// lower edge of bin `i`; `edge(n_bins())` is the upper end of the grid
+  Float edge(std::size_t i) const noexcept { return edges_[i]; }
+  Float width(std::size_t i) const noexcept { return widths_[i]; }
+
+  const Float* edges() const noexcept { return edges_.data(); }
+  const Float* widths() const noexcept { return widths_.data(); }
+
+  /// replace the edges by `edges[0, n_bins()]`, which must increase from 0
+  /// to 1
+  void assign(const Float* edges) noexcept {
+    std::copy(edges, edges + edges_.size(), edges_.begin());
+    update_widths();
+  }
+
+  /// bin that contains `x`
+  std::size_t find(Float x) const noexcept {
+    const auto it = std::upper_bound(edges_.begin() + 1, edges_.end() - 1, x);
+    return std::size_t(it - (edges_.begin() + 1));
+  }
+
+  /// Move the edges according to the per-bin importance `d` (size
+  /// `n_bins()`, non-negative).  `alpha` controls the damping of the
+  /// rebinning as in the original VEGAS algorithm; larger values adapt faster.
+  void refine(const double* d, double alpha) {
+    const std::size_t n = n_bins();
+    if (n < 2) return;
+
+    // smoothed and normalised importance
+    double sum = 0.;
+    for (std::size_t i = 0; i < n; ++i) {
+      double avg;
+      if (i == 0) {
+        avg = (d[0] + d[1]) / 2.;
+      } else if (i + 1 == n) {
+        avg = (d[n - 2] + d[n - 1]) / 2.;
+      } else {
+        avg = (d[i - 1] + d[i] + d[i + 1]) / 3.;
+      }
+      rebin_[i] = avg;
+      sum += avg;
+    }
+    if (!(sum > 0.) || !std::isfinite(sum)) return;
+
+    // VEGAS damping
+    double sum_r = 0.;
+    for (auto& r : rebin_) {
+      const double di = r / sum;
+      if (di <= 0.) {
+        r = 0.;
+      } else if (di >= 1.) {
+        r = 1.;
+      } else {
+        r = std::pow((di - 1.) / std::log(di), alpha);
+      }
+      sum_r += r;
+    }
+    if (!(sum_r > 0.)) return;
+
+    // redistribute the edges such that every new bin carries sum_r / n
+    const double delta = sum_r / double(n);
+    Float* new_edges = scratch_.data();
+    new_edges[0] = Float(0);
+    double acc = 0.;
+    std::size_t j = 0;
+    for (std::size_t k = 1; k < n; ++k) {
+      while (acc < delta && j < n) acc += rebin_[j++];
+      acc -= delta;
+      const double r = rebin_[j - 1];
+      new_edges[k] =
+          r > 0. ? Float(double(edges_[j]) - acc / r * double(widths_[j - 1]))
+                 : edges_[j];
+    }
+    new_edges[n] = Float(1);
+    std::copy(new_edges, new_edges + n + 1, edges_.begin());
+    update_widths();
+  }
+
+ private:
+  void update_widths() noexcept {
+    for (std::size_t i = 0; i < widths_.size(); ++i) {
+      widths_[i] = edges_[i + 1] - edges_[i];
+    }
+  }
+
+  std::vector<Float> edges_;
+  std::vector<Float> widths_;
+  std::vector<Float> scratch_;
+  std::vector<double> rebin_;
+};
+
+}  // namespace kakuhen
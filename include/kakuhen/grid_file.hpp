@@ -0,0 +1,264 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define KAKUHEN_HAVE_MMAP 1
+#endif
+
+#include "kakuhen/options.hpp"
+
+namespace kakuhen {
+
+/// Binary file format of an adapted sampling density (grids and two-point
+/// tables) as written by `Integrator::save_grid`.
+///
+/// A 64-byte `GridHeader` is followed by the payload, whose sections start
+/// at multiples of 64 bytes so that a file mapped into memory can be used in
+/// place (see `GridView`):
+///
+///   parents  uint32[dimension]                  (`npos`: none)
+///   edges    Float[dimension][n_bins + 1]
+///   tables   Float[n_pairs][n_bins][n_bins]     [parent bin][bin]
+///
+/// with one table for every dimension that has a parent, in increasing
+/// order of the dimension.  Numbers are stored in the byte order of the
+/// writing machine, which a reader checks against its own.
+namespace grid_file {
+
+constexpr char magic[8] = {'K', 'A', 'K', 'U', 'G', 'R', 'I', 'D'};
+constexpr std::uint32_t version = 1;
+constexpr std::uint32_t byte_order = 0x01020304u;
+constexpr std::uint32_t npos = ~std::uint32_t(0);
+constexpr std::size_t alignment = 64;
+
+/// FNV-1a hash of `size` bytes; `h` continues the hash of preceding data
+inline std::uint64_t checksum(const void* data, std::size_t size,
+                              std::uint64_t h = 0xcbf29ce484222325ULL) noexcept {
+  const auto* p = static_cast<const unsigned char*>(data);
+  for (std::size_t i = 0; i < size; ++i) {
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+constexpr std::size_t align(std::size_t n) noexcept {
+  return (n + alignment - 1) / alignment * alignment;
+}
+
+}  // namespace grid_file
+
+struct GridHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  /// size in bytes of the floating-point numbers
+  std::uint32_t float_size;
+  std::uint32_t dimension;
+  std::uint32_t n_bins;
+  /// `Structure` the density was adapted with
+  std::uint32_t structure;
+  /// number of dimensions with a parent
+  std::uint32_t n_pairs;
+  std::uint32_t reserved0;
+  std::uint64_t payload_size;
+  /// `grid_file::checksum` of the payload
+  std::uint64_t checksum;
+  std::uint64_t reserved1;
+};
+static_assert(sizeof(GridHeader) == grid_file::alignment,
+              "kakuhen::GridHeader: unexpected padding");
+
+/// Offsets of the payload sections relative to the start of the file.
+struct GridSections {
+  GridSections(std::size_t dimension, std::size_t n_bins, std::size_t n_pairs,
+               std::size_t float_size) noexcept
+      : parents(sizeof(GridHeader)),
+        edges(parents + grid_file::align(dimension * sizeof(std::uint32_t))),
+        tables(edges +
+               grid_file::align(dimension * (n_bins + 1) * float_size)),
+        end(tables + grid_file::align(n_pairs * n_bins * n_bins * float_size)) {
+  }
+
+  std::size_t parents;
+  std::size_t edges;
+  std::size_t tables;
+  /// total file size
+  std::size_t end;
+};
+
+/// Read-only view of a grid file held in memory (typically a `MappedFile`).
+/// Construction validates the header and, with `verify`, the checksum; the
+/// accessors then point into the buffer without copying.
+template <typename Float>
+class GridView {
+ public:
+  /// throws `std::runtime_error` if the buffer does not hold a valid grid
+  /// file with numbers of type `Float` in the byte order of this machine
+  GridView(const void* data, std::size_t size, bool verify = true)
+      : data_(static_cast<const unsigned char*>(data)) {
+    if (size < sizeof(GridHeader) ||
+        reinterpret_cast<std::uintptr_t>(data) %
+                std::max(alignof(GridHeader), alignof(Float)) !=
+            0) {
+      fail("truncated or misaligned buffer");
+    }
+    std::memcpy(&header_, data_, sizeof header_);
+    if (std::memcmp(header_.magic, grid_file::magic, sizeof header_.magic)) {
+      fail("not a grid file");
+    }
+    if (header_.version != grid_file::version) fail("unsupported version");
+    if (header_.byte_order != grid_file::byte_order) fail("wrong byte order");
+    if (header_.float_size != sizeof(Float)) fail("wrong floating-point type");
+    if (header_.dimension == 0 || header_.n_bins == 0 ||
+        header_.n_pairs >= header_.dimension) {
+      fail("inconsistent header");
+    }
+    const GridSections sec(header_.dimension, header_.n_bins, header_.n_pairs,
+                           sizeof(Float));
+    if (header_.payload_size != sec.end - sizeof(GridHeader) ||
+        size < sec.end) {
+      fail("truncated file");
+    }
+    if (verify && grid_file::checksum(data_ + sizeof(GridHeader),
+                                      header_.payload_size) !=
+                      header_.checksum) {
+      fail("checksum mismatch");
+    }
+    parents_ = reinterpret_cast<const std::uint32_t*>(data_ + sec.parents);
+    edges_ = reinterpret_cast<const Float*>(data_ + sec.edges);
+    tables_ = reinterpret_cast<const Float*>(data_ + sec.tables);
+    std::size_t n_pairs = 0;
+    for (std::size_t d = 0; d < dimension(); ++d) {
+      if (parents_[d] == grid_file::npos) continue;
+      if (parents_[d] >= dimension() || parents_[d] == d) {
+        fail("invalid parent");
+      }
+      ++n_pairs;
+    }
+    if (n_pairs != header_.n_pairs) fail("inconsistent header");
+  }
+
+  const GridHeader& header() const noexcept { return header_; }
+  std::size_t dimension() const noexcept { return header_.dimension; }
+  std::size_t n_bins() const noexcept { return header_.n_bins; }
+  std::size_t n_pairs() const noexcept { return header_.n_pairs; }
+  Structure structure() const noexcept { return Structure(header_.structure); }
+
+  /// parent of dimension `d` or `grid_file::npos`
+  std::uint32_t parent(std::size_t d) const noexcept { return parents_[d]; }
+  /// the `n_bins() + 1` edges of the grid of dimension `d`
+  const Float* edges(std::size_t d) const noexcept {
+    return edges_ + d * (n_bins() + 1);
+  }
+  /// table `k` of `n_pairs()`, belonging to the `k`-th dimension that has a
+  /// parent
+  const Float* table(std::size_t k) const noexcept {
+    return tables_ + k * n_bins() * n_bins();
+  }
+
+ private:
+  [[noreturn]] static void fail(const char* what) {
+    throw std::runtime_error(std::string("kakuhen::GridView: ") + what);
+  }
+
+  const unsigned char* data_;
+  GridHeader header_;
+  const std::uint32_t* parents_ = nullptr;
+  const Float* edges_ = nullptr;
+  const Float* tables_ = nullptr;
+};
+
+/// A whole file mapped read-only into memory (or read into a buffer where
+/// `mmap` is not available).  The pages are shared between all processes
+/// mapping the same file.
+class MappedFile {
+ public:
+  /// throws `std::system_error` if the file cannot be opened or mapped
+  explicit MappedFile(const std::string& path) {
+#ifdef KAKUHEN_HAVE_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) fail(path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      fail(path);
+    }
+    size_ = std::size_t(st.st_size);
+    if (size_ > 0) {
+      void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        fail(path);
+      }
+      data_ = p;
+    }
+    ::close(fd);
+#else
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) fail(path);
+    size_ = std::size_t(in.tellg());
+    buffer_.resize((size_ + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t));
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(buffer_.data()), std::streamsize(size_));
+    if (!in) fail(path);
+    data_ = buffer_.data();
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other) noexcept
+      : data_(std::exchange(other.data_, nullptr)),
+        size_(std::exchange(other.size_, 0)),
+        buffer_(std::move(other.buffer_)) {}
+  MappedFile& operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+      unmap();
+      data_ = std::exchange(other.data_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+      buffer_ = std::move(other.buffer_);
+    }
+    return *this;
+  }
+  ~MappedFile() { unmap(); }
+
+  const void* data() const noexcept { return data_; }
+  std::size_t size() const noexcept { return size_; }
+
+ private:
+  [[noreturn]] static void fail(const std::string& path) {
+    throw std::system_error(errno, std::generic_category(),
+                            "kakuhen::MappedFile: " + path);
+  }
+
+  void unmap() noexcept {
+#ifdef KAKUHEN_HAVE_MMAP
+    if (data_ != nullptr) ::munmap(const_cast<void*>(data_), size_);
+#endif
+    data_ = nullptr;
+  }
+
+  const void* data_ = nullptr;
+  std::size_t size_ = 0;
+  /// file contents without `mmap`
+  std::vector<std::uint64_t> buffer_;
+};
+
+}  // namespace kakuhen
+
+#undef KAKUHEN_HAVE_MMAP
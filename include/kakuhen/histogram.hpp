@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "kakuhen/result.hpp"
+
+namespace kakuhen {
+
+template <std::size_t Dim, typename Float>
+class Integrator;
+
+/// Sums of one histogram bin over a chunk of points: the weight, the
+/// weight^2 (per point, of the sum of its contributions) and the number of
+/// contributions.
+struct HistogramCell {
+  std::uint32_t bin;
+  double sum;
+  double sum2;
+  std::uint64_t count;
+};
+
+/// Set of 1D histograms of observables, filled while the integrator
+/// samples (see `Integrator::iterate` with histograms) and combined over
+/// iterations.
+///
+/// Every iteration of N points estimates the integral of the contributions
+/// over a bin as sum(v w) / N, with the variance from the sum of (v w)^2.
+/// The iterations are combined with the weights of the total integral
+/// (`Result::weight`), so the bins of a histogram that receives the whole
+/// integrand add up to `Result::value()`.  Contributions outside [lo, hi)
+/// are dropped.
+class Histograms {
+ public:
+  /// Add a histogram of `n_bins` equal bins over [lo, hi) and return its
+  /// index; throws `std::invalid_argument` unless `n_bins > 0` and
+  /// `lo < hi`.
+  std::size_t add(std::size_t n_bins, double lo, double hi) {
+    if (n_bins == 0 || !(lo < hi)) {
+      throw std::invalid_argument(
+          "kakuhen::Histograms::add: empty histogram or range");
+    }
+    specs_.push_back(
+        {total_bins(), n_bins, lo, hi, double(n_bins) / (hi - lo)});
+    const std::size_t total = total_bins();
+    sum_.resize(total, 0.);
+    sum2_.resize(total, 0.);
+    count_.resize(total, 0);
+    sum_wv_.resize(total, 0.);
+    sum_w2var_.resize(total, 0.);
+    total_count_.resize(total, 0);
+    return specs_.size() - 1;
+  }
+
+  std::size_t size() const noexcept { return specs_.size(); }
+  std::size_t n_bins(std::size_t h) const noexcept { return specs_[h].n_bins; }
+  double lo(std::size_t h) const noexcept { return specs_[h].lo; }
+  double hi(std::size_t h) const noexcept { return specs_[h].hi; }
+  /// lower edge of bin `b` of histogram `h`
+  double edge(std::size_t h, std::size_t b) const noexcept {
+    const Spec& s = specs_[h];
+    return s.lo + double(b) * (s.hi - s.lo) / double(s.n_bins);
+  }
+
+  /// bin of `obs` in histogram `h`, or `n_bins(h)` if it is outside
+  std::size_t find(std::size_t h, double obs) const noexcept {
+    const Spec& s = specs_[h];
+    if (!(obs >= s.lo && obs < s.hi)) return s.n_bins;
+    return std::min(std::size_t((obs - s.lo) * s.scale), s.n_bins - 1);
+  }
+
+  /// integral over bin `b` of histogram `h` combined over all iterations
+  double value(std::size_t h, std::size_t b) const noexcept {
+    return sum_w_ > 0. ? sum_wv_[specs_[h].offset + b] / sum_w_ : 0.;
+  }
+  double error(std::size_t h, std::size_t b) const noexcept {
+    return sum_w_ > 0. ? std::sqrt(sum_w2var_[specs_[h].offset + b]) / sum_w_
+                       : 0.;
+  }
+  /// contributions to bin `b` of histogram `h` over all iterations
+  std::uint64_t count(std::size_t h, std::size_t b) const noexcept {
+    return total_count_[specs_[h].offset + b];
+  }
+  std::size_t n_iterations() const noexcept { return n_iter_; }
+
+  /// drop the results of all iterations; the histograms stay defined
+  void clear() noexcept {
+    std::fill(sum_wv_.begin(), sum_wv_.end(), 0.);
+    std::fill(sum_w2var_.begin(), sum_w2var_.end(), 0.);
+    std::fill(total_count_.begin(), total_count_.end(), 0);
+    sum_w_ = 0.;
+    n_iter_ = 0;
+  }
+
+ private:
+  template <std::size_t, typename>
+  friend class Integrator;
+  template <typename>
+  friend class HistogramFill;
+
+  struct Spec {
+    std::size_t offset;
+    std::size_t n_bins;
+    double lo, hi;
+    /// bins per unit of the observable
+    double scale;
+  };
+
+  /// bins of all histograms, numbered consecutively
+  std::size_t total_bins() const noexcept {
+    return specs_.empty() ? 0 : specs_.back().offset + specs_.back().n_bins;
+  }
+
+  /// add the sums of a chunk to the current iteration
+  void merge(const std::vector<HistogramCell>& cells) noexcept {
+    for (const HistogramCell& c : cells) {
+      sum_[c.bin] += c.sum;
+      sum2_[c.bin] += c.sum2;
+      count_[c.bin] += c.count;
+    }
+  }
+
+  /// close an iteration of `n` points whose total integral has the
+  /// combination weight `weight`
+  void end_iteration(std::uint64_t n, double weight) noexcept {
+    const double dn = double(n);
+    for (std::size_t i = 0; i < sum_.size(); ++i) {
+      if (n > 0) {
+        const double v = sum_[i] / dn;
+        const double var =
+            n > 1 ? std::max(sum2_[i] / dn - v * v, 0.) / (dn - 1.) : 0.;
+        sum_wv_[i] += weight * v;
+        sum_w2var_[i] += weight * weight * var;
+      }
+      total_count_[i] += count_[i];
+    }
+    drop_iteration();
+    sum_w_ += weight;
+    ++n_iter_;
+  }
+
+  /// discard the sums of the current iteration
+  void drop_iteration() noexcept {
+    std::fill(sum_.begin(), sum_.end(), 0.);
+    std::fill(sum2_.begin(), sum2_.end(), 0.);
+    std::fill(count_.begin(), count_.end(), 0);
+  }
+
+  std::vector<Spec> specs_;
+  /// sums of the current iteration
+  std::vector<double> sum_;
+  std::vector<double> sum2_;
+  std::vector<std::uint64_t> count_;
+  /// combination over iterations
+  std::vector<double> sum_wv_;
+  std::vector<double> sum_w2var_;
+  std::vector<std::uint64_t> total_count_;
+  double sum_w_ = 0.;
+  std::size_t n_iter_ = 0;
+};
+
+/// Thread-private filling of `Histograms` handed to the integrand.
+///
+/// A batch integrand calls `fill(i, h, obs, value)` to add the contribution
+/// `value` of point `i` at the observable `obs` to histogram `h`; the
+/// integrator multiplies it by the weight of the point.  `fill.point(i)`
+/// gives the same for a single point as `fill(h, obs, value)`.  The
+/// contributions of a block are sorted by point, so that a point filling a
+/// bin several times enters its weight^2 once with their sum, and are added
+/// to private dense bins whose touched cells the integrator collects per
+/// chunk.
+template <typename Float>
+class HistogramFill {
+ public:
+  /// filling of a single point of the block
+  class Point {
+   public:
+    void operator()(std::size_t h, double obs, double value) const {
+      (*fill_)(i_, h, obs, value);
+    }
+
+   private:
+    friend class HistogramFill;
+    Point(HistogramFill* fill, std::size_t i) noexcept : fill_(fill), i_(i) {}
+
+    HistogramFill* fill_;
+    std::size_t i_;
+  };
+
+  void operator()(std::size_t i, std::size_t h, double obs, double value) {
+    if (hist_ == nullptr) return;
+    const std::size_t b = hist_->find(h, obs);
+    if (b == hist_->n_bins(h)) return;
+    entries_.push_back({std::uint32_t(hist_->specs_[h].offset + b),
+                        std::uint32_t(i), value * double(weight_[i])});
+  }
+
+  Point point(std::size_t i) noexcept { return Point(this, i); }
+
+ private:
+  template <std::size_t, typename>
+  friend class Integrator;
+
+  struct Entry {
+    std::uint32_t bin;
+    std::uint32_t point;
+    double value;
+  };
+
+  /// start filling `hist` (nullptr: ignore all contributions) from blocks
+  /// whose weights are at `weight`
+  void attach(const Histograms* hist, const Float* weight) {
+    hist_ = hist;
+    weight_ = weight;
+    entries_.clear();
+    point_ = 0;
+    if (hist == nullptr) return;
+    const std::size_t total = hist->total_bins();
+    sum_.assign(total, 0.);
+    sum2_.assign(total, 0.);
+    current_.assign(total, 0.);
+    count_.assign(total, 0);
+    last_.assign(total, 0);
+    touched_.clear();
+  }
+
+  /// add the contributions of a block of `n` points to the bins
+  void end_block(std::size_t n) {
+    if (hist_ == nullptr) return;
+    // counting sort by point
+    start_.assign(n + 1, 0);
+    for (const Entry& e : entries_) ++start_[e.point + 1];
+    for (std::size_t i = 0; i < n; ++i) start_[i + 1] += start_[i];
+    sorted_.resize(entries_.size());
+    for (const Entry& e : entries_) sorted_[start_[e.point]++] = e;
+    for (const Entry& e : sorted_) {
+      // points are numbered from 1 within the chunk; 0 marks an untouched
+      // bin
+      const std::uint64_t p = point_ + e.point + 1;
+      if (last_[e.bin] != p) {
+        if (last_[e.bin] == 0) {
+          touched_.push_back(e.bin);
+        } else {
+          sum2_[e.bin] += current_[e.bin] * current_[e.bin];
+        }
+        last_[e.bin] = p;
+        current_[e.bin] = 0.;
+      }
+      current_[e.bin] += e.value;
+      sum_[e.bin] += e.value;
+      ++count_[e.bin];
+    }
+    entries_.clear();
+    point_ += n;
+  }
+
+  /// move the sums of the chunk into `cells`, in the order the bins were
+  /// first touched
+  void end_chunk(std::vector<HistogramCell>& cells) {
+    cells.clear();
+    for (const std::uint32_t b : touched_) {
+      cells.push_back({b, sum_[b], sum2_[b] + current_[b] * current_[b],
+                       count_[b]});
+      sum_[b] = sum2_[b] = current_[b] = 0.;
+      count_[b] = 0;
+      last_[b] = 0;
+    }
+    touched_.clear();
+    point_ = 0;
+  }
+
+  const Histograms* hist_ = nullptr;
+  const Float* weight_ = nullptr;
+  std::vector<Entry> entries_;
+  std::vector<Entry> sorted_;
+  std::vector<std::size_t> start_;
+  /// private bins of the current chunk, the contribution of the last point
+  /// per bin and that point's number
+  std::vector<double> sum_;
+  std::vector<double> sum2_;
+  std::vector<double> current_;
+  std::vector<std::uint64_t> count_;
+  std::vector<std::uint64_t> last_;
+  std::vector<std::uint32_t> touched_;
+  /// points of the chunk before the current block
+  std::uint64_t point_ = 0;
+};
+
+}  // namespace kakuhen
@@ -0,0 +1,2427 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "kakuhen/accumulator.hpp"
+#include "kakuhen/batch.hpp"
+#include "kakuhen/checkpoint.hpp"
+#include "kakuhen/control.hpp"
+#include "kakuhen/event.hpp"
+#include "kakuhen/grid.hpp"
+#include "kakuhen/grid_file.hpp"
+#include "kakuhen/histogram.hpp"
+#include "kakuhen/lattice.hpp"
+#include "kakuhen/options.hpp"
+#include "kakuhen/pairs.hpp"
+#include "kakuhen/philox.hpp"
+#include "kakuhen/profile.hpp"
+#include "kakuhen/result.hpp"
+#include "kakuhen/scheduler.hpp"
+#include "kakuhen/simd.hpp"
+#include "kakuhen/sketch.hpp"
+#include "kakuhen/snapshot.hpp"
+#include "kakuhen/sobol.hpp"
+#include "kakuhen/thread_pool.hpp"
+
+namespace kakuhen {
+
+template <std::size_t Dim, typename Mappings, typename Float>
+class MultiChannel;
+
+/// Importance-sampling Monte Carlo integrator over the unit hypercube.
+///
+/// Every dimension carries an adaptive 1D grid (the VEGAS map).  On top of
+/// that, a dimension with a parent selects its bin conditionally on the bin
+/// drawn for the parent from a two-point table of conditional bin
+/// probabilities, so that the sampling density retains the correlation
+/// between the two.  The parents form a forest over the dimensions chosen by
+/// `Options::structure`: the chain of neighbouring dimensions, a given list
+/// of pairs, a Chow-Liu tree learned from the data, or no pairs at all
+/// (plain VEGAS, which skips every two-point code path).  Both the grids and
+/// the tables are refined from the importance |f * w| accumulated during an
+/// iteration.
+///
+/// With `Options::stratify` the uniform numbers mapped into the points are
+/// in addition stratified (VEGAS+): their unit hypercube is divided into
+/// equal hypercubes that receive a number of points adapted to the variance
+/// measured in each, which reduces the variance for integrands with several
+/// separated peaks.  The map from the uniform numbers to the points goes
+/// dimension by dimension through the grids and the conditional tables, so
+/// the stratification works alike with and without pairs.
+///
+/// With `Options::sampling = Sampling::sobol` or `Sampling::lattice` the
+/// uniform numbers are randomised quasi-Monte Carlo points instead (see
+/// `SobolStream` and `LatticeStream`), and the error of an iteration is
+/// taken from the spread of the estimates of its independent
+/// randomisations.  The conditional bins are then drawn by inverting the
+/// CDF of the row, which is monotone in the uniform number and so keeps the
+/// even spread of the points.
+///
+/// A defensive mixture (`Options::defensive`) draws a fraction of the points
+/// from a safe density, uniform or the 1D grids alone, and weights all
+/// points with the inverse of the mixture density, which bounds the weights
+/// where the adapted density under-covers the integrand.
+///
+/// Points are generated in blocks of `Options::batch_size` (see `Batch`),
+/// which are either handed to the integrand as a whole (`iterate_batch`) or
+/// point by point (`iterate`).  All buffers are allocated on construction
+/// (only sparse pair histograms, see `Options::sparse_pairs`, grow on
+/// demand): the sampling loop performs no heap allocation and the integrand
+/// is a template parameter, i.e. it is called without any indirection.
+///
+/// An iteration is split into chunks of `Options::chunk_size` points that
+/// are distributed over `Options::n_threads` workers by work stealing (see
+/// `WorkStealingScheduler`); the integrand must therefore be safe to call
+/// concurrently.  Every chunk draws from its own counter-based random stream
+/// (see `PhiloxStream`), labelled by the iteration and the chunk, and the
+/// workers fill private, fixed-point refinement histograms (see
+/// `Quantizer`), so results are bit-identical for any number of threads and
+/// any scheduling of the chunks.
+template <std::size_t Dim, typename Float = double>
+class Integrator {
+  static_assert(Dim > 0, "kakuhen::Integrator: dimension must be positive");
+  static_assert(std::is_floating_point_v<Float>,
+                "kakuhen::Integrator: Float must be a floating-point type");
+
+ public:
+  using float_type = Float;
+  using bin_type = std::uint32_t;
+  using point_type = std::array<Float, Dim>;
+  using batch_type = Batch<Dim, Float>;
+  using event_type = Event<Dim, Float>;
+  using fill_type = HistogramFill<Float>;
+
+  static constexpr std::size_t dimension = Dim;
+  /// parent of a dimension sampled independently of all others
+  static constexpr std::size_t npos = PairLayout::npos;
+
+  /// throws `std::invalid_argument` if `Options::pairs` does not describe a
+  /// forest over the dimensions, or if the defensive mixture is invalid or
+  /// combined with stratification
+  explicit Integrator(const Options& opts = Options{})
+      : Integrator(opts, std::make_shared<ThreadPool>(opts.n_threads)) {}
+
+  const Options& options() const noexcept { return opts_; }
+  std::size_t n_bins() const noexcept { return n_bins_; }
+  std::size_t n_threads() const noexcept { return pool_->size(); }
+  const Grid<Float>& grid(std::size_t d) const noexcept { return grids_[d]; }
+  /// storage layout of the two-point tables
+  const PairLayout& pair_layout() const noexcept { return layout_; }
+
+  /// dimension that dimension `d` is conditional on, or `npos`
+  std::size_t parent(std::size_t d) const noexcept { return parent_[d]; }
+
+  /// number of strata per dimension of the last iteration (1: none)
+  std::size_t n_strata() const noexcept { return n_strata_; }
+
+  /// probability to select bin `b` in dimension `d` given that bin `bp` was
+  /// selected in its parent; requires `parent(d) != npos`
+  Float conditional(std::size_t d, std::size_t bp, std::size_t b) const {
+    return cond_[block_[d] + bp * n_bins_ + b];
+  }
+
+  /// sampling density at the point `x` of the unit hypercube, i.e. the
+  /// inverse of the weight of a point drawn at `x` (without stratification)
+  Float density(const point_type& x) const noexcept {
+    std::array<bin_type, Dim> bin;
+    for (std::size_t d = 0; d < Dim; ++d) {
+      bin[d] = bin_type(grids_[d].find(x[d]));
+    }
+    const auto [p, safe] = densities(bin);
+    return Float((1. - mix_) * p + mix_ * safe);
+  }
+
+  /// current fraction of the defensive mixture (see `Options::defensive`)
+  double defensive() const noexcept { return mix_; }
+
+  /// Run a single iteration of `n_samples` points.  The integrand is called
+  /// as `f(x)` with `x` a `point_type` in the unit hypercube.  With `adapt`
+  /// the grids are refined afterwards, otherwise the refinement data keeps
+  /// accumulating until the next call to `adapt`.
+  template <typename F>
+  Estimate iterate(F&& f, std::uint64_t n_samples, bool adapt = true) {
+    return iterate_batch(
+        [&f](const batch_type& batch, Float* values) {
+          for (std::size_t i = 0; i < batch.size(); ++i) {
+            values[i] = Float(f(batch.point(i)));
+          }
+        },
+        n_samples, adapt);
+  }
+
+  /// `iterate` filling `hist` on the way: the integrand is called as
+  /// `f(x, fill)` and adds the contributions of the point to the histograms
+  /// with `fill(h, obs, value)` (see `HistogramFill`).  The bins of the
+  /// iteration are combined into `hist` with the weight of the iteration in
+  /// `result()`.
+  template <typename F>
+  Estimate iterate(F&& f, Histograms& hist, std::uint64_t n_samples,
+                   bool adapt = true) {
+    return iterate_batch(
+        [&f](const batch_type& batch, Float* values, fill_type& fill) {
+          for (std::size_t i = 0; i < batch.size(); ++i) {
+            values[i] = Float(f(batch.point(i), fill.point(i)));
+          }
+        },
+        hist, n_samples, adapt);
+  }
+
+  /// Same as `iterate` for an integrand that evaluates a whole block of
+  /// points at once: it is called as `f(batch, values)` with `batch` a
+  /// `const batch_type&` of at most `Options::batch_size` points and must
+  /// store the integrand value of point `i` in `values[i]`.
+  template <typename F>
+  Estimate iterate_batch(F&& f, std::uint64_t n_samples, bool adapt = true) {
+    return run_iteration(
+        [&f](const batch_type& batch, Float* values, fill_type&) {
+          f(batch, values);
+        },
+        nullptr, n_samples, adapt);
+  }
+
+  /// `iterate_batch` filling `hist`: the integrand is called as
+  /// `f(batch, values, fill)` and adds the contributions of point `i` with
+  /// `fill(i, h, obs, value)`.  The workers fill private bins, whose sums
+  /// per chunk are merged in the order of the chunks, so the histograms are
+  /// the same for any number of threads.
+  template <typename F>
+  Estimate iterate_batch(F&& f, Histograms& hist, std::uint64_t n_samples,
+                         bool adapt = true) {
+    return run_iteration(f, &hist, n_samples, adapt);
+  }
+
+  /// `n_iter` calls to `iterate`; returns the combined result
+  template <typename F>
+  const Result& integrate(F&& f, std::size_t n_iter, std::uint64_t n_samples,
+                          bool adapt = true) {
+    for (std::size_t it = 0; it < n_iter; ++it) iterate(f, n_samples, adapt);
+    return result_;
+  }
+
+  /// `n_iter` calls to `iterate_batch`; returns the combined result
+  template <typename F>
+  const Result& integrate_batch(F&& f, std::size_t n_iter,
+                                std::uint64_t n_samples, bool adapt = true) {
+    for (std::size_t it = 0; it < n_iter; ++it) {
+      iterate_batch(f, n_samples, adapt);
+    }
+    return result_;
+  }
+
+  /// `n_iter` calls to `iterate` filling `hist`
+  template <typename F>
+  const Result& integrate(F&& f, Histograms& hist, std::size_t n_iter,
+                          std::uint64_t n_samples, bool adapt = true) {
+    for (std::size_t it = 0; it < n_iter; ++it) {
+      iterate(f, hist, n_samples, adapt);
+    }
+    return result_;
+  }
+
+  /// `n_iter` calls to `iterate_batch` filling `hist`
+  template <typename F>
+  const Result& integrate_batch(F&& f, Histograms& hist, std::size_t n_iter,
+                                std::uint64_t n_samples, bool adapt = true) {
+    for (std::size_t it = 0; it < n_iter; ++it) {
+      iterate_batch(f, hist, n_samples, adapt);
+    }
+    return result_;
+  }
+
+  /// Iterate until a criterion of `control` is met: `result()` reaches the
+  /// relative error, the wall-clock or busy time is used up, or the
+  /// iterations run out (see `RunControl`).  The workers check the
+  /// criteria whenever they finish a chunk, and a stop cuts the current
+  /// iteration short to the run of finished chunks from the first one on
+  /// (dropped from the result if it holds less than a quarter of the
+  /// points).  Stopping on the error of the estimate itself biases it
+  /// slightly, by much less than the error once the grid has converged.
+  /// The iterations start with `control.n_samples` points and grow once
+  /// the variance per point stops improving.  The result combines all
+  /// iterations since `clear_result`, including those before the run.
+  /// With `Options::stratify` the allocation to the hypercubes, and with
+  /// quasi-Monte Carlo points the randomisations, need complete iterations,
+  /// and the criteria are checked between iterations.
+  /// Throws `std::invalid_argument` if no criterion is set or
+  /// `control.n_samples` is 0.
+  template <typename F>
+  RunReport run(F&& f, const RunControl& control) {
+    return run_batch(
+        [&f](const batch_type& batch, Float* values) {
+          for (std::size_t i = 0; i < batch.size(); ++i) {
+            values[i] = Float(f(batch.point(i)));
+          }
+        },
+        control);
+  }
+
+  /// `run` for a batch integrand (see `iterate_batch`)
+  template <typename F>
+  RunReport run_batch(F&& f, const RunControl& control) {
+    if (!(control.rel_error > 0. || control.wall_time > 0. ||
+          control.cpu_time > 0. || control.max_iterations > 0)) {
+      throw std::invalid_argument(
+          "kakuhen::Integrator::run: no stopping criterion");
+    }
+    if (control.n_samples == 0) {
+      throw std::invalid_argument("kakuhen::Integrator::run: no samples");
+    }
+    using clock = std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+    const auto g = [&f](const batch_type& batch, Float* values, fill_type&) {
+      f(batch, values);
+    };
+    // a run resumed from a checkpoint continues with its state and budget
+    if (!run_.active) {
+      run_ = RunState{};
+      run_.active = true;
+      run_.n = control.n_samples;
+    }
+    const clock::time_point start =
+        clock::now() -
+        std::chrono::duration_cast<clock::duration>(seconds(run_.wall));
+    Limits limits;
+    if (control.wall_time > 0.) {
+      limits.deadline =
+          start + std::chrono::duration_cast<clock::duration>(
+                      seconds(control.wall_time));
+    }
+    limits.cpu_budget = std::int64_t(control.cpu_time * 1e9);
+    limits.rel_error = control.rel_error;
+    limits.min_iterations = control.min_iterations;
+
+    RunReport report;
+    try {
+      while (true) {
+        limits.cpu_used.store(std::int64_t(run_.cpu * 1e9));
+        const Estimate est =
+            run_iteration(g, nullptr, run_.n, control.adapt,
+                          opts_.stratify || n_random_ > 0 ? nullptr : &limits);
+        for (const Worker& wk : workers_) run_.cpu += wk.busy.count();
+        run_.wall = seconds(clock::now() - start).count();
+        ++run_.iterations;
+        run_.samples += est.n_samples;
+        if (limits.stopped.load()) {
+          report.truncated = est.n_samples < run_.n;
+          break;
+        }
+        if (control.rel_error > 0. &&
+            result_.n_iterations() >= control.min_iterations &&
+            result_.error() <= control.rel_error * std::abs(result_.value())) {
+          limits.stop(Stop::rel_error);
+        } else if (control.wall_time > 0. && run_.wall >= control.wall_time) {
+          limits.stop(Stop::wall_time);
+        } else if (control.cpu_time > 0. && run_.cpu >= control.cpu_time) {
+          limits.stop(Stop::cpu_time);
+        } else if (control.max_iterations > 0 &&
+                   run_.iterations >= control.max_iterations) {
+          limits.stop(Stop::max_iterations);
+        }
+        if (limits.stopped.load()) break;
+        run_.n = next_samples(control, run_.n, est, run_.previous);
+      }
+    } catch (...) {
+      run_.active = false;
+      throw;
+    }
+    run_.active = false;
+    report.reason = limits.reason;
+    report.n_iterations = run_.iterations;
+    report.n_samples = run_.samples;
+    report.wall_time = run_.wall;
+    report.cpu_time = run_.cpu;
+    return report;
+  }
+
+  /// Generate unweighted events from the current density (which is not
+  /// refined): each of `n_samples` trial points is accepted with
+  /// probability min(1, |f w| / max_weight) and passed to `sink` as
+  /// `sink(const event_type&)` with the weight +-max_weight, or its full
+  /// weight if it is overweight, so that the events remain an unbiased
+  /// sample of f.  The events are delivered while the chunks finish, from
+  /// one thread at a time and in the order of the chunks, i.e. the event
+  /// stream is the same for any number of threads.  `max_weight()` after a
+  /// non-adapting iteration is a natural choice for `max_weight`.  Turns
+  /// on the weight sketch (`Options::weight_sketch`) for the iterations
+  /// that follow.  Throws `std::invalid_argument` unless `max_weight > 0`.
+  template <typename F, typename Sink>
+  Unweighting unweight(F&& f, Sink&& sink, std::uint64_t n_samples,
+                       double max_weight) {
+    return unweight_batch(
+        [&f](const batch_type& batch, Float* values) {
+          for (std::size_t i = 0; i < batch.size(); ++i) {
+            values[i] = Float(f(batch.point(i)));
+          }
+        },
+        sink, n_samples, max_weight);
+  }
+
+  /// `unweight` for a batch integrand (see `iterate_batch`)
+  template <typename F, typename Sink>
+  Unweighting unweight_batch(F&& f, Sink&& sink, std::uint64_t n_samples,
+                             double max_weight) {
+    if (!(max_weight > 0.)) {
+      throw std::invalid_argument(
+          "kakuhen::Integrator::unweight: max_weight must be positive");
+    }
+    opts_.weight_sketch = true;
+    const std::uint64_t chunk = opts_.chunk_size;
+    const std::size_t n_chunks = std::size_t((n_samples + chunk - 1) / chunk);
+    allocate_strata(n_samples);
+    allocate_randomizations(n_samples);
+    chunk_sums_.assign(n_chunks, Sums{});
+    std::fill(cube_partials_.begin(), cube_partials_.end(), Sums{});
+
+    // accepted events per chunk, handed to the sink in chunk order
+    Unweighting stats;
+    stats.max_weight = max_weight;
+    std::vector<std::vector<event_type>> events(n_chunks);
+    std::vector<bool> finished(n_chunks, false);
+    std::size_t next = 0;
+    std::mutex mutex;
+
+    scheduler_.reset(std::uint32_t(n_chunks), task_grain());
+    pool_->run([&](std::size_t w) {
+      Worker& wk = workers_[w];
+      std::uint32_t begin, end;
+      while (scheduler_.next(w, begin, end)) {
+        for (std::size_t c = begin; c < end; ++c) {
+          const std::uint64_t n = std::min(chunk, n_samples - c * chunk);
+          std::vector<event_type>& out = events[c];
+          chunk_sums_[c] = run_chunk(f, wk, c, n, false, [&](Worker&) {
+            const std::size_t m = wk.batch.size();
+            const Float* wt = wk.batch.weight();
+            Float* r = wk.uniform.data();
+            wk.rng.fill_uniform(r, m);
+            for (std::size_t i = 0; i < m; ++i) {
+              const double fw = double(wk.values[i]) * double(wt[i]);
+              const double a = std::abs(fw);
+              if (!(double(r[i]) * max_weight < a)) continue;
+              const double weight = std::max(a, max_weight);
+              out.push_back(
+                  {wk.batch.point(i), Float(fw < 0. ? -weight : weight)});
+            }
+          });
+          std::lock_guard<std::mutex> lock(mutex);
+          finished[c] = true;
+          for (; next < n_chunks && finished[next]; ++next) {
+            for (const event_type& e : events[next]) {
+              sink(static_cast<const event_type&>(e));
+              stats.overweight += std::abs(double(e.weight)) > max_weight;
+            }
+            stats.accepted += events[next].size();
+            std::vector<event_type>().swap(events[next]);
+          }
+        }
+      }
+    });
+    ++iteration_;
+
+    Sums sums;
+    for (const Sums& s : chunk_sums_) sums += s;
+    stats.estimate = sums.estimate();
+    if (n_cubes_ > 1) {
+      // the allocation stays as it is, only the error is taken
+      const std::vector<double> var = strata_var_;
+      stats.estimate.error = reduce_strata(n_samples);
+      strata_var_ = var;
+    } else if (n_random_ > 0) {
+      stats.estimate.error = reduce_randomizations();
+    }
+    stats.trials = n_samples;
+    end_profile(iteration_ - 1, n_samples);
+    return stats;
+  }
+
+  /// largest |f w| of the points evaluated since the last refinement
+  double max_weight() const noexcept { return pending_.max_abs; }
+
+  /// Quantile `q` of the non-zero |f w| of the points evaluated since the
+  /// last refinement (see `WeightSketch`).  Unless `Options::weight_sketch`
+  /// is set, the first call turns the recording on for the iterations that
+  /// follow and returns 0.  As threshold of `unweight` a quantile slightly
+  /// below 1 gives partial unweighting: the rare outliers that set
+  /// `max_weight()` are kept as overweight events with their full weight
+  /// instead of lowering the efficiency of all others.
+  double weight_quantile(double q) {
+    opts_.weight_sketch = true;
+    reduce_sketches();
+    return sketch_.quantile(q);
+  }
+
+  /// combination of all iterations since construction or `clear_result`
+  const Result& result() const noexcept { return result_; }
+  void clear_result() noexcept { result_.clear(); }
+
+  /// Stage times (see `Stage`) per iteration and thread since construction
+  /// or `clear_profile`.  The timers are compiled in only with
+  /// `KAKUHEN_PROFILE` defined; otherwise the profile stays empty.  A
+  /// refinement is counted in the iteration that triggers it, or in the
+  /// next one for an explicit `adapt`.
+  const std::vector<IterationProfile>& profile() const noexcept {
+    return profile_;
+  }
+  /// the stage times per iteration and thread as JSON
+  void write_profile(std::ostream& out) const {
+    write_profile_json(out, profile_);
+  }
+  /// every chunk and refinement as an event of the Chrome trace-event
+  /// format, on the track of its thread and with its stage times
+  void write_trace(std::ostream& out) const { write_chrome_trace(out, trace_); }
+  void clear_profile() noexcept {
+    profile_.clear();
+    trace_.clear();
+    for (Worker& wk : workers_) wk.profile.clear();
+  }
+
+  /// Refine the 1D grids and the two-point tables from the data accumulated
+  /// since the last refinement.  While a Chow-Liu tree is being learned,
+  /// the tree is rebuilt first.
+  void adapt() {
+    ThreadProfile& profile = workers_.front().profile;
+    TraceSpan span(profile);
+    Stopwatch watch(profile);
+    reduce();
+    refine();
+    watch.lap(Stage::refinement);
+    span.close("refine", 0, epoch_);
+  }
+
+  /// Refine from the data of `snapshot` (typically merged from many runs)
+  /// instead of the data accumulated by this integrator, which is dropped.
+  /// The snapshot carries no stratification data: the allocation of the
+  /// points to the hypercubes (`Options::stratify`) is kept as it is, and
+  /// so is the fraction of the defensive mixture.
+  /// Throws `std::invalid_argument` if the snapshot was not taken with the
+  /// current density and pairs.
+  void adapt(const Snapshot& snapshot) {
+    if (!snapshot.compatible(snapshot_header())) {
+      throw std::invalid_argument(
+          "kakuhen::Integrator::adapt: snapshot of a different density");
+    }
+    acc1_ = snapshot.one;
+    accp_ = snapshot.pair;
+    pending_ = snapshot.sums;
+    sketch_ = snapshot.weights;
+    std::fill(pending_mix_.begin(), pending_mix_.end(), 0.);
+    std::fill(strata_var_.begin(), strata_var_.end(), 0.);
+    ThreadProfile& profile = workers_.front().profile;
+    TraceSpan span(profile);
+    Stopwatch watch(profile);
+    refine();
+    watch.lap(Stage::refinement);
+    span.close("refine", 0, epoch_);
+  }
+
+  /// Refinement data accumulated since the last refinement, e.g. to be
+  /// saved and merged with the snapshots of other runs (see `Snapshot`).
+  Snapshot snapshot() {
+    reduce();
+    Snapshot s = snapshot_header();
+    s.sums = pending_;
+    s.one = acc1_;
+    s.pair = accp_;
+    s.weights = sketch_;
+    return s;
+  }
+
+  /// Complete state of the integrator (see `Checkpoint`), from which
+  /// `resume` continues bit-identically.  During the iterations the
+  /// integrator writes it itself with `Options::checkpoint_path`.
+  Checkpoint checkpoint() const {
+    const std::size_t nb = n_bins_;
+    Checkpoint c;
+    c.dimension = std::uint32_t(Dim);
+    c.n_bins = std::uint32_t(nb);
+    c.float_size = std::uint32_t(sizeof(Float));
+    c.structure = std::uint32_t(opts_.structure);
+    c.seed = opts_.seed;
+    c.chunk_size = opts_.chunk_size;
+    c.batch_size = opts_.batch_size;
+    c.stratify = opts_.stratify;
+    c.sampling = std::uint32_t(opts_.sampling);
+    c.randomizations = std::uint32_t(n_random_);
+    c.defensive = opts_.defensive;
+    c.defensive_density = std::uint32_t(opts_.defensive_density);
+    c.defensive_adapt = opts_.defensive_adapt;
+    c.sparse_pairs = opts_.sparse_pairs;
+    for (std::size_t p = 0; p < layout_.size(); ++p) {
+      c.pairs.push_back(std::uint32_t(layout_.first(p)));
+      c.pairs.push_back(std::uint32_t(layout_.second(p)));
+    }
+    for (std::size_t d = 0; d < Dim; ++d) {
+      c.parents.push_back(parent_[d] == npos ? grid_file::npos
+                                             : std::uint32_t(parent_[d]));
+      c.edges.insert(c.edges.end(), grids_[d].edges(),
+                     grids_[d].edges() + nb + 1);
+    }
+    c.tables.assign(cond_.begin(), cond_.end());
+    c.refinements = refinements_;
+    c.iteration = iteration_;
+    c.calibrated = calibrated_;
+    c.unit = quantizer_.unit();
+    c.mix = mix_;
+    c.pending_mix.assign(pending_mix_.begin(), pending_mix_.end());
+    c.n_strata = n_strata_;
+    c.strata_weight = strata_weight_;
+    c.strata_var = strata_var_;
+
+    // integer histograms and sketches: the sum over the workers is exact
+    Accumulator acc(acc1_.size(), accp_.size(), opts_.sparse_pairs);
+    c.weights = sketch_;
+    c.weight_sketch = opts_.weight_sketch;
+    for (const Worker& wk : workers_) {
+      acc += wk.acc;
+      c.weights += wk.weights;
+    }
+    c.pending = pending_;
+    c.one = acc.one;
+    acc.for_each_pair([&c](std::uint32_t cell, Quantizer::value_type q) {
+      c.pair_cells.push_back(cell);
+      c.pair_counts.push_back(q);
+    });
+    c.result = result_;
+
+    c.n_samples = current_n_ > 0 ? current_n_ : resume_n_;
+    if (c.n_samples > 0) {
+      c.done = chunk_done_;
+      c.chunk_sums = chunk_sums_;
+      c.chunk_mix = chunk_mix_;
+      c.cube_partials = cube_partials_;
+      // chunks whose refinement data is still held apart from the workers'
+      // are run again after a resume
+      for (std::size_t k = 0; k < held_.size(); ++k) {
+        if (!held_[k]) continue;
+        c.done[k] = 0;
+        c.chunk_sums[k] = Sums{};
+        if (opts_.defensive_adapt) {
+          std::fill_n(c.chunk_mix.begin() + k * n_mix, n_mix, 0.);
+        }
+      }
+    }
+    c.run_active = run_.active;
+    c.run_n = run_.n;
+    c.run_previous = run_.previous;
+    c.run_iterations = run_.iterations;
+    c.run_samples = run_.samples;
+    c.run_wall = run_.wall;
+    c.run_cpu = run_.cpu;
+    return c;
+  }
+
+  /// Continue from the state `c` of an integrator constructed with the
+  /// same options: an iteration it left in progress is completed by the
+  /// next iteration, which must have the same number of points and fill no
+  /// histograms, and a `run` it left in progress continues with the next
+  /// call to `run`.  Throws `std::invalid_argument` if the checkpoint was
+  /// taken with other options (structure and, but for `Structure::tree`,
+  /// its pairs included; after `load_grid` those of the grid file) or is
+  /// inconsistent, its parents not stored pairs or its histogram cells
+  /// out of range, and `std::runtime_error` if its strata or chunks do not
+  /// have the sizes of these options.
+  void resume(const Checkpoint& c) {
+    const std::size_t nb = n_bins_;
+    std::vector<PairLayout::pair_type> pairs;
+    for (std::size_t k = 0; k + 1 < c.pairs.size(); k += 2) {
+      pairs.emplace_back(c.pairs[k], c.pairs[k + 1]);
+    }
+    const PairLayout layout(Dim, nb, std::move(pairs));
+    bool same_pairs = layout.size() == layout_.size();
+    for (std::size_t p = 0; same_pairs && p < layout_.size(); ++p) {
+      same_pairs = layout.pair(p) == layout_.pair(p);
+    }
+    // only the tree chooses its pairs, the other structures fix them
+    if (c.dimension != Dim || c.n_bins != nb ||
+        c.float_size != sizeof(Float) ||
+        c.structure != std::uint32_t(opts_.structure) ||
+        (opts_.structure != Structure::tree && !same_pairs) ||
+        c.seed != opts_.seed || c.chunk_size != opts_.chunk_size ||
+        c.batch_size != opts_.batch_size ||
+        bool(c.stratify) != opts_.stratify ||
+        c.sampling != std::uint32_t(opts_.sampling) ||
+        c.randomizations != n_random_ || c.defensive != opts_.defensive ||
+        c.defensive_density != std::uint32_t(opts_.defensive_density) ||
+        bool(c.defensive_adapt) != opts_.defensive_adapt ||
+        bool(c.sparse_pairs) != opts_.sparse_pairs) {
+      throw std::invalid_argument(
+          "kakuhen::Integrator::resume: checkpoint of different options");
+    }
+    bool consistent =
+        c.parents.size() == Dim && c.edges.size() == Dim * (nb + 1) &&
+        c.tables.size() == layout.n_cells() && c.one.size() == acc1_.size() &&
+        c.pending_mix.size() == n_mix &&
+        c.pair_cells.size() == c.pair_counts.size();
+    std::array<std::size_t, Dim> parents;
+    for (std::size_t d = 0; consistent && d < Dim; ++d) {
+      const std::uint32_t q = c.parents[d];
+      parents[d] = q == grid_file::npos ? npos : q;
+      consistent = q == grid_file::npos ||
+                   (q < Dim && q != d &&
+                    layout.slot(std::min<std::size_t>(q, d),
+                                std::max<std::size_t>(q, d)) != npos);
+    }
+    for (std::size_t k = 0; consistent && k < c.pair_cells.size(); ++k) {
+      consistent = c.pair_cells[k] < layout.n_cells();
+    }
+    if (!consistent) {
+      throw std::invalid_argument(
+          "kakuhen::Integrator::resume: inconsistent checkpoint");
+    }
+    check_chunks(c);
+    orient(parents);
+
+    layout_ = layout;
+    update_blocks();
+    std::vector<Float> edges(nb + 1);
+    for (std::size_t d = 0; d < Dim; ++d) {
+      std::copy_n(c.edges.begin() + d * (nb + 1), nb + 1, edges.begin());
+      grids_[d].assign(edges.data());
+    }
+    cond_.assign(c.tables.begin(), c.tables.end());
+    alias_prob_.assign(cond_.size(), Float(0));
+    alias_.assign(cond_.size(), 0);
+    cdf_.assign(inverts(opts_) ? cond_.size() : 0, Float(0));
+    for (std::size_t d = 0; d < Dim; ++d) update_sampling(d);
+    accp_.assign(cond_.size(), 0.);
+    for (Worker& wk : workers_) {
+      wk.acc = Accumulator(acc1_.size(), accp_.size(), opts_.sparse_pairs);
+      wk.weights.clear();
+    }
+    set_accumulation();
+    refinements_ = std::size_t(c.refinements);
+
+    Accumulator& acc = workers_.front().acc;
+    acc.one = c.one;
+    for (std::size_t k = 0; k < c.pair_cells.size(); ++k) {
+      acc.add_pair(c.pair_cells[k], c.pair_counts[k]);
+    }
+    sketch_ = c.weights;
+    opts_.weight_sketch = bool(c.weight_sketch);
+    pending_ = c.pending;
+    result_ = c.result;
+    iteration_ = c.iteration;
+    calibrated_ = c.calibrated;
+    quantizer_.set_unit(c.unit);
+    mix_ = c.mix;
+    std::copy_n(c.pending_mix.begin(), n_mix, pending_mix_.begin());
+    set_strata(std::size_t(c.n_strata));
+    strata_weight_ = c.strata_weight;
+    strata_var_ = c.strata_var;
+
+    resume_n_ = c.n_samples;
+    held_.clear();
+    chunk_done_ = c.done;
+    chunk_sums_ = c.chunk_sums;
+    chunk_mix_ = c.chunk_mix;
+    cube_partials_ = c.cube_partials;
+    run_.active = c.run_active;
+    run_.n = c.run_n;
+    run_.previous = c.run_previous;
+    run_.iterations = std::size_t(c.run_iterations);
+    run_.samples = c.run_samples;
+    run_.wall = c.run_wall;
+    run_.cpu = c.run_cpu;
+    schedule_checkpoint();
+  }
+
+  /// write `checkpoint()` to `path` atomically (see `Checkpoint::save`)
+  void save_checkpoint(const std::string& path) const {
+    checkpoint().save(path);
+  }
+
+  /// `resume` from the checkpoint file `path`
+  void load_checkpoint(const std::string& path) {
+    resume(Checkpoint::load(path));
+  }
+
+  /// wait for the checkpoint being written in the background, if any, and
+  /// rethrow its error
+  void flush_checkpoint() {
+    if (writer_.valid()) writer_.get();
+  }
+
+  /// fingerprint of the sampling density: grids, parents and tables
+  std::uint64_t density_id() const noexcept {
+    std::uint64_t h = grid_file::checksum(parent_.data(), sizeof parent_);
+    for (const Grid<Float>& g : grids_) {
+      h = grid_file::checksum(g.edges(), (n_bins_ + 1) * sizeof(Float), h);
+    }
+    h = grid_file::checksum(&mix_, sizeof mix_, h);
+    return grid_file::checksum(cond_.data(), cond_.size() * sizeof(Float), h);
+  }
+
+  /// Write the grids, parents and two-point tables in the binary format
+  /// described in `grid_file.hpp`.
+  void save_grid(std::ostream& out) const {
+    std::vector<std::uint32_t> parents(Dim, grid_file::npos);
+    std::size_t n_pairs = 0;
+    for (std::size_t d = 0; d < Dim; ++d) {
+      if (parent_[d] == npos) continue;
+      parents[d] = std::uint32_t(parent_[d]);
+      ++n_pairs;
+    }
+    const std::size_t nb = n_bins_;
+    const GridSections sec(Dim, nb, n_pairs, sizeof(Float));
+    std::vector<unsigned char> file(sec.end, 0);
+    std::memcpy(file.data() + sec.parents, parents.data(),
+                Dim * sizeof(std::uint32_t));
+    for (std::size_t d = 0; d < Dim; ++d) {
+      std::memcpy(file.data() + sec.edges + d * (nb + 1) * sizeof(Float),
+                  grids_[d].edges(), (nb + 1) * sizeof(Float));
+    }
+    std::size_t k = 0;
+    for (std::size_t d = 0; d < Dim; ++d) {
+      if (parent_[d] == npos) continue;
+      std::memcpy(file.data() + sec.tables + k++ * nb * nb * sizeof(Float),
+                  cond_.data() + block_[d], nb * nb * sizeof(Float));
+    }
+
+    GridHeader header{};
+    std::memcpy(header.magic, grid_file::magic, sizeof header.magic);
+    header.version = grid_file::version;
+    header.byte_order = grid_file::byte_order;
+    header.float_size = sizeof(Float);
+    header.dimension = std::uint32_t(Dim);
+    header.n_bins = std::uint32_t(nb);
+    header.structure = std::uint32_t(opts_.structure);
+    header.n_pairs = std::uint32_t(n_pairs);
+    header.payload_size = sec.end - sizeof(GridHeader);
+    header.checksum = grid_file::checksum(file.data() + sizeof(GridHeader),
+                                          header.payload_size);
+    std::memcpy(file.data(), &header, sizeof header);
+    out.write(reinterpret_cast<const char*>(file.data()),
+              std::streamsize(file.size()));
+  }
+
+  /// throws `std::system_error` if the file cannot be written
+  void save_grid(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (out) save_grid(out);
+    if (!out.flush()) {
+      throw std::system_error(errno, std::generic_category(),
+                              "kakuhen::Integrator::save_grid: " + path);
+    }
+  }
+
+  /// Replace the grids, parents and two-point tables by those of a grid
+  /// file; the structure is fixed to the stored pairs from then on
+  /// (`Structure::pairs`, or `Structure::none` for a file without pairs)
+  /// and the accumulated refinement data is dropped.
+  /// Throws `std::invalid_argument` if the dimension or the number of bins
+  /// differ, or if the parents form a cycle.
+  void load_grid(const GridView<Float>& view) {
+    if (view.dimension() != Dim || view.n_bins() != n_bins_) {
+      throw std::invalid_argument(
+          "kakuhen::Integrator::load_grid: dimension or bins differ");
+    }
+    std::array<std::size_t, Dim> parents;
+    for (std::size_t d = 0; d < Dim; ++d) {
+      parents[d] = view.parent(d) == grid_file::npos ? npos : view.parent(d);
+    }
+    orient(parents);
+    for (std::size_t d = 0; d < Dim; ++d) grids_[d].assign(view.edges(d));
+    set_forest(view.table(0));
+    opts_.structure = layout_.size() > 0 ? Structure::pairs : Structure::none;
+    opts_.pairs.assign(layout_.size(), {});
+    for (std::size_t p = 0; p < layout_.size(); ++p) {
+      opts_.pairs[p] = layout_.pair(p);
+    }
+    clear_histograms();
+  }
+
+  /// map the grid file `path` and load it (see `MappedFile`)
+  void load_grid(const std::string& path) {
+    const MappedFile file(path);
+    load_grid(GridView<Float>(file.data(), file.size()));
+  }
+
+ private:
+  template <std::size_t, typename, typename>
+  friend class MultiChannel;
+
+  /// integrator running on `pool`, which may be shared with others that are
+  /// not used concurrently (the channels of a `MultiChannel`)
+  Integrator(const Options& opts, std::shared_ptr<ThreadPool> pool)
+      : opts_(opts),
+        n_bins_(opts.n_bins),
+        layout_(initial_layout(opts)),
+        cond_(layout_.n_cells(), Float(1) / Float(opts.n_bins)),
+        alias_prob_(cond_.size()),
+        alias_(cond_.size()),
+        cdf_(inverts(opts) ? cond_.size() : 0),
+        acc1_(Dim * opts.n_bins, 0.),
+        accp_(cond_.size(), 0.),
+        pool_(std::move(pool)),
+        scheduler_(pool_->size()),
+        mix_(opts.defensive),
+        n_random_(opts.sampling != Sampling::random ? opts.randomizations
+                                                    : 0) {
+    if (!(mix_ >= 0. && mix_ < 1.)) {
+      throw std::invalid_argument(
+          "kakuhen::Integrator: defensive fraction must be in [0, 1)");
+    }
+    if ((mix_ > 0. || opts.defensive_adapt) && opts.stratify) {
+      throw std::invalid_argument(
+          "kakuhen::Integrator: defensive mixture and stratification "
+          "exclude each other");
+    }
+    if (opts.sampling != Sampling::random &&
+        (opts.stratify || opts.randomizations < 2)) {
+      throw std::invalid_argument(
+          "kakuhen::Integrator: quasi-Monte Carlo points need at least two "
+          "randomisations and exclude stratification");
+    }
+    if (opts.defensive_adapt && mix_ == 0.) mix_ = mix_fractions[0];
+    opts_.batch_size = std::max<std::size_t>(opts_.batch_size, 1);
+    opts_.chunk_size = std::max<std::size_t>(opts_.chunk_size, 1);
+    for (auto& g : grids_) g = Grid<Float>(n_bins_);
+    set_strata(1);
+    set_parents(initial_edges());
+    for (std::size_t d = 0; d < Dim; ++d) update_sampling(d);
+    workers_.reserve(pool_->size());
+    for (std::size_t i = 0; i < pool_->size(); ++i) {
+      workers_.emplace_back(opts_.batch_size, acc1_.size(), accp_.size(),
+                            opts_.sparse_pairs);
+    }
+    if (opts_.sampling == Sampling::sobol) sobol_ = SobolSequence(Dim);
+    if (opts_.sampling == Sampling::lattice) lattice_ = lattice_rule();
+    if (n_random_ > 0) {
+      for (Worker& wk : workers_) {
+        wk.sobol = SobolStream(Dim, n_random_);
+        wk.lattice = LatticeStream(Dim, n_random_);
+        wk.quasi.resize(Dim * opts_.batch_size);
+      }
+    }
+    set_accumulation();
+    schedule_checkpoint();
+  }
+
+  /// choose the accumulation of the pair histograms for the current pairs
+  /// and size the buffers of the sort path (see `Options::accumulation`)
+  void set_accumulation() {
+    const std::size_t block = n_bins_ * n_bins_;
+    const std::size_t bytes = block * sizeof(Quantizer::value_type);
+    sort_pairs_ = layout_.size() > 0 &&
+                  (opts_.accumulation == Accumulation::sort ||
+                   (opts_.accumulation == Accumulation::automatic &&
+                    !opts_.sparse_pairs && bytes > opts_.cache_size));
+    cell_bits_ = 0;
+    while ((std::size_t(1) << cell_bits_) < block) ++cell_bits_;
+    const std::size_t n = sort_pairs_ ? opts_.batch_size : 0;
+    for (Worker& wk : workers_) {
+      wk.cells.resize(n);
+      wk.cells_tmp.resize(n);
+      wk.counts.resize(n);
+      wk.counts_tmp.resize(n);
+      wk.buckets.reserve(sort_pairs_ ? std::size_t(1) << (cell_bits_ + 1) / 2
+                                     : 0);
+    }
+  }
+
+  /// refine the grids and tables from `acc1_` and `accp_`
+  void refine() {
+    const std::size_t nb = n_bins_;
+    for (std::size_t d = 0; d < Dim; ++d) {
+      grids_[d].refine(acc1_.data() + d * nb, opts_.alpha);
+    }
+    const std::array<std::size_t, Dim> previous = parent_;
+    if (learning()) set_parents(chow_liu());
+    refine_tables(previous);
+    ++refinements_;
+    if (opts_.structure == Structure::tree && opts_.tree_updates > 0 &&
+        refinements_ == opts_.tree_updates) {
+      freeze_tree();
+    }
+    for (std::size_t d = 0; d < Dim; ++d) update_sampling(d);
+    refine_strata();
+    refine_mix();
+    clear_histograms();
+  }
+
+  /// snapshot without data, identifying the current density and pairs
+  Snapshot snapshot_header() const {
+    Snapshot s;
+    s.dimension = std::uint32_t(Dim);
+    s.n_bins = std::uint32_t(n_bins_);
+    s.density = density_id();
+    s.pairs.resize(layout_.size());
+    for (std::size_t p = 0; p < layout_.size(); ++p) {
+      s.pairs[p] = layout_.pair(p);
+    }
+    return s;
+  }
+
+  /// empty the refinement histograms and re-centre the fixed-point unit
+  void clear_histograms() {
+    for (Worker& wk : workers_) {
+      wk.acc.clear();
+      wk.weights.clear();
+    }
+    sketch_.clear();
+    if (pending_.n > 0 && pending_.sum_abs > 0.) set_unit(pending_);
+    pending_ = Sums{};
+  }
+
+  /// resolution of the refinement histograms relative to the mean |f * w|
+  static constexpr double unit_fraction = 0x1.0p-24;
+
+  /// Sampling buffers, random stream and refinement histograms owned by one
+  /// thread of the pool.
+  struct Worker {
+    Worker(std::size_t capacity, std::size_t n_one, std::size_t n_pair,
+           bool sparse)
+        : batch(capacity),
+          values(capacity),
+          uniform(capacity),
+          prob(capacity),
+          importance(capacity),
+          dens(capacity),
+          safe(capacity),
+          cube(capacity),
+          acc(n_one, n_pair, sparse) {
+      picked.reserve(capacity);
+    }
+
+    batch_type batch;
+    std::vector<Float> values;
+    std::vector<Float> uniform;
+    std::vector<Float> prob;
+    std::vector<Quantizer::value_type> importance;
+    /// density of the grids and tables and the safe density of every point
+    /// of the batch, and the points drawn from the latter (defensive
+    /// mixture only)
+    std::vector<double> dens;
+    std::vector<double> safe;
+    std::vector<std::uint32_t> picked;
+    /// (cell, count) pairs of one pair of the block for
+    /// `Accumulation::sort`, and the scratch of the radix sort
+    std::vector<std::uint32_t> cells;
+    std::vector<std::uint32_t> cells_tmp;
+    std::vector<Quantizer::value_type> counts;
+    std::vector<Quantizer::value_type> counts_tmp;
+    std::vector<std::size_t> buckets;
+    WeightSketch weights;
+    fill_type fill;
+    /// hypercube (or randomisation of the quasi-Monte Carlo points) of
+    /// every point of
+    /// the batch, and the partial sums of the hypercubes of the current
+    /// chunk from `first_cube` on
+    std::vector<std::uint32_t> cube;
+    Sums* cube_sums = nullptr;
+    std::size_t first_cube = 0;
+    Accumulator acc;
+    PhiloxStream rng;
+    /// quasi-Monte Carlo points of the chunk (one of the two, see
+    /// `Options::sampling`) and those of the block, [dimension][point]
+    SobolStream sobol;
+    LatticeStream lattice;
+    std::vector<Float> quasi;
+    /// time spent on the last iteration
+    std::chrono::duration<double> busy{0.};
+    /// stage times and trace since the last `end_profile`
+    ThreadProfile profile;
+  };
+
+  /// Stopping state of `run` shared by the workers of an iteration.
+  /// Refinement data of one chunk of an iteration with limits, held apart
+  /// until the chunk joins the prefix that the iteration keeps (sparse, as
+  /// a chunk fills few pair cells).
+  struct ChunkData {
+    ChunkData(std::size_t n_one, std::size_t n_pair)
+        : acc(n_one, n_pair, true) {}
+
+    Accumulator acc;
+    WeightSketch weights;
+  };
+
+  /// Sends the refinement data of a worker to `data` while it lives.
+  class Divert {
+   public:
+    Divert(Worker& wk, ChunkData& data) noexcept : wk_(wk), data_(data) {
+      swap();
+    }
+    ~Divert() { swap(); }
+    Divert(const Divert&) = delete;
+    Divert& operator=(const Divert&) = delete;
+
+   private:
+    void swap() noexcept {
+      std::swap(wk_.acc, data_.acc);
+      std::swap(wk_.weights, data_.weights);
+    }
+
+    Worker& wk_;
+    ChunkData& data_;
+  };
+
+  struct Limits {
+    using clock = std::chrono::steady_clock;
+
+    /// stop at the end of the current chunks for `why` (the first reason
+    /// given wins)
+    void stop(Stop why) noexcept {
+      bool expected = false;
+      if (stopped.compare_exchange_strong(expected, true)) reason = why;
+    }
+
+    clock::time_point deadline = clock::time_point::max();
+    /// busy time of the threads allowed (0: no limit) and used so far, in
+    /// nanoseconds
+    std::int64_t cpu_budget = 0;
+    std::atomic<std::int64_t> cpu_used{0};
+    double rel_error = 0.;
+    std::size_t min_iterations = 0;
+    std::atomic<bool> stopped{false};
+    Stop reason = Stop::max_iterations;
+  };
+
+  /// One iteration of the integrand `f(batch, values, fill)`, filling
+  /// `hist` unless it is null (see `iterate_batch`).  With `limits` the
+  /// workers stop taking chunks once a limit is reached (see `run`); the
+  /// iteration then consists of the longest run of finished chunks from
+  /// the first one, whose selection does not depend on the integrand
+  /// values but only on timing, and the refinement data of the chunks
+  /// finished beyond it is dropped with them.
+  template <typename F>
+  Estimate run_iteration(F&& f, Histograms* hist, std::uint64_t n_samples,
+                         bool adapt, Limits* limits = nullptr) {
+    const std::uint64_t chunk = opts_.chunk_size;
+    const std::size_t n_chunks = std::size_t((n_samples + chunk - 1) / chunk);
+    allocate_strata(n_samples);
+    allocate_randomizations(n_samples);
+    if (!calibrated_ && n_samples > 0) {
+      // the pilot run fills no histograms
+      Worker& wk = workers_.front();
+      const auto g = [&f, &wk](const batch_type& batch, Float* values) {
+        f(batch, values, wk.fill);
+      };
+      calibrate(g, std::min(chunk, n_samples));
+    }
+
+    if (resume_n_ > 0) {
+      // the chunks finished before the checkpoint are restored
+      if (n_samples != resume_n_ || hist) {
+        throw std::invalid_argument(
+            "kakuhen::Integrator: the resumed iteration needs the same "
+            "points and fills no histograms");
+      }
+      resume_n_ = 0;
+    } else {
+      chunk_sums_.assign(n_chunks, Sums{});
+      std::fill(cube_partials_.begin(), cube_partials_.end(), Sums{});
+      if (opts_.defensive_adapt) chunk_mix_.assign(n_chunks * n_mix, 0.);
+      chunk_done_.assign(n_chunks, 0);
+    }
+    held_.clear();
+    held_.resize(limits ? n_chunks : 0);
+    // histogram sums per chunk, merged in chunk order as the chunks finish,
+    // and the sums of the finished chunks from the first one on
+    std::vector<std::vector<HistogramCell>> cells(hist ? n_chunks : 0);
+    const bool ordered = hist != nullptr || limits != nullptr;
+    std::vector<bool> finished(ordered ? n_chunks : 0, false);
+    std::size_t next = ordered ? 0 : n_chunks;
+    Sums prefix;
+    std::mutex mutex;
+    for (Worker& wk : workers_) wk.fill.attach(hist, wk.batch.weight());
+    // periodic checkpoints, taken while all workers are between chunks
+    const bool periodic = !opts_.checkpoint_path.empty() && hist == nullptr;
+    Rendezvous meet(pool_->size());
+    const auto save = [this]() noexcept { checkpoint_async(); };
+    current_n_ = n_samples;
+
+    scheduler_.reset(std::uint32_t(n_chunks), task_grain());
+    pool_->run([&](std::size_t w) {
+      Worker& wk = workers_[w];
+      const auto g = [&f, &wk](const batch_type& batch, Float* values) {
+        f(batch, values, wk.fill);
+      };
+      using clock = std::chrono::steady_clock;
+      const Rendezvous::Seat<decltype(save)> seat(meet, save);
+      const auto start = clock::now();
+      auto last = start;
+      std::uint32_t begin, end;
+      while (scheduler_.next(w, begin, end)) {
+        for (std::size_t c = begin; c < end; ++c) {
+          if (limits && limits->stopped.load(std::memory_order_relaxed)) {
+            break;
+          }
+          if (!chunk_done_[c]) {
+            const std::uint64_t n = std::min(chunk, n_samples - c * chunk);
+            const auto run = [&]() {
+              return run_chunk(g, wk, c, n, true, [](Worker& v) {
+                v.fill.end_block(v.batch.size());
+              });
+            };
+            if (limits) {
+              held_[c] = std::make_unique<ChunkData>(acc1_.size(),
+                                                     accp_.size());
+              const Divert divert(wk, *held_[c]);
+              chunk_sums_[c] = run();
+            } else {
+              chunk_sums_[c] = run();
+            }
+            if (hist) wk.fill.end_chunk(cells[c]);
+            chunk_done_[c] = 1;
+          }
+          if (periodic) {
+            if (!meet.requested() && clock::now() >= next_checkpoint_) {
+              meet.request();
+            }
+            if (meet.requested()) meet.arrive(save);
+          }
+          if (limits) check_time(*limits, last);
+          if (!ordered) continue;
+          std::lock_guard<std::mutex> lock(mutex);
+          finished[c] = true;
+          for (; next < n_chunks && finished[next]; ++next) {
+            if (hist) {
+              hist->merge(cells[next]);
+              std::vector<HistogramCell>().swap(cells[next]);
+            }
+            if (limits) {
+              if (held_[next]) {
+                wk.acc += held_[next]->acc;
+                wk.weights += held_[next]->weights;
+                held_[next].reset();
+              }
+              prefix += chunk_sums_[next];
+              check_precision(*limits, prefix, n_samples);
+            }
+          }
+        }
+        if (limits && limits->stopped.load(std::memory_order_relaxed)) break;
+      }
+      wk.busy = clock::now() - start;
+    });
+    current_n_ = 0;
+    // the refinement data of chunks finished beyond the prefix is dropped
+    held_.clear();
+    for (Worker& wk : workers_) wk.fill.attach(nullptr, nullptr);
+
+    // fixed-order reduction of the sums of the finished chunks
+    Sums sums;
+    for (std::size_t c = 0; c < next; ++c) sums += chunk_sums_[c];
+    update_cost(sums.n);
+    pending_ += sums;
+    chunk_mix_.resize(std::min(chunk_mix_.size(), next * n_mix));
+    for (std::size_t i = 0; i < chunk_mix_.size(); ++i) {
+      pending_mix_[i % n_mix] += chunk_mix_[i];
+    }
+    chunk_mix_.clear();
+    ++iteration_;
+
+    Estimate est = sums.estimate();
+    if (n_cubes_ > 1) est.error = reduce_strata(n_samples);
+    if (n_random_ > 0) est.error = reduce_randomizations();
+    if (next < n_chunks) {
+      // cut short: the refinement data is kept unrefined, and with less
+      // than a quarter of the points the error estimate is not trusted
+      // and the iteration is dropped from the result
+      if (4 * sums.n < n_samples) {
+        if (hist) hist->drop_iteration();
+        est = Estimate{};
+      } else {
+        result_.add(est);
+        if (hist) hist->end_iteration(sums.n, Result::weight(est));
+      }
+      end_profile(iteration_ - 1, sums.n);
+      rethrow_checkpoint();
+      return est;
+    }
+    result_.add(est);
+    if (hist) hist->end_iteration(n_samples, Result::weight(est));
+    if (adapt) this->adapt();
+    end_profile(iteration_ - 1, n_samples);
+    rethrow_checkpoint();
+    return est;
+  }
+
+  /// time of the next periodic checkpoint
+  void schedule_checkpoint() {
+    next_checkpoint_ =
+        std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(opts_.checkpoint_interval));
+  }
+
+  /// Take a checkpoint and write it from a background thread, unless the
+  /// previous one is still being written; called while no worker is
+  /// inside a chunk.  An error is kept for `rethrow_checkpoint`.
+  void checkpoint_async() noexcept {
+    try {
+      schedule_checkpoint();
+      if (writer_.valid()) {
+        if (writer_.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+          return;
+        }
+        writer_.get();
+      }
+      writer_ = std::async(std::launch::async,
+                           [c = checkpoint(), path = opts_.checkpoint_path] {
+                             c.save(path);
+                           });
+    } catch (...) {
+      checkpoint_error_ = std::current_exception();
+    }
+  }
+
+  /// rethrow the error of a periodic checkpoint
+  void rethrow_checkpoint() {
+    if (!checkpoint_error_) return;
+    std::exception_ptr error = nullptr;
+    std::swap(error, checkpoint_error_);
+    std::rethrow_exception(error);
+  }
+
+  /// Points of the iteration of `run` after one of `n` points with the
+  /// estimate `est`; `previous` is the variance per point of the iteration
+  /// before and is updated.
+  std::uint64_t next_samples(const RunControl& control, std::uint64_t n,
+                             const Estimate& est,
+                             double& previous) const noexcept {
+    const double var = est.error * est.error * double(est.n_samples);
+    const bool converged =
+        !control.adapt ||
+        (previous > 0. && var > (1. - control.convergence) * previous);
+    if (var > 0.) previous = var;
+    double next = double(n);
+    if (converged) next *= std::max(control.growth, 1.);
+    // no more than the points expected to bring the combined error to the
+    // target
+    const double target = control.rel_error * std::abs(result_.value());
+    if (target > 0. && var > 0. && result_.error() > 0.) {
+      const double have = result_.error();
+      const double needed = var * (1. / (target * target) - 1. / (have * have));
+      next = std::min(next, std::max(needed, double(opts_.chunk_size)));
+    }
+    if (control.max_samples > 0) {
+      next = std::min(next, double(control.max_samples));
+    }
+    return std::max<std::uint64_t>(std::uint64_t(std::ceil(next)), 1);
+  }
+
+  /// stop `limits` once the wall-clock or busy time is used up; `last`:
+  /// end of the previous chunk of the worker
+  static void check_time(Limits& limits,
+                         std::chrono::steady_clock::time_point& last) noexcept {
+    const auto now = std::chrono::steady_clock::now();
+    const std::int64_t ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - last)
+            .count();
+    last = now;
+    const std::int64_t used =
+        limits.cpu_used.fetch_add(ns, std::memory_order_relaxed) + ns;
+    if (now >= limits.deadline) limits.stop(Stop::wall_time);
+    if (limits.cpu_budget > 0 && used >= limits.cpu_budget) {
+      limits.stop(Stop::cpu_time);
+    }
+  }
+
+  /// Stop `limits` once the result combined with the finished chunks
+  /// `prefix` of the current iteration of `n_samples` points reaches the
+  /// relative error.  The prefix must hold a quarter of the iteration, so
+  /// that its error estimate is not taken from a handful of chunks that
+  /// missed a peak.
+  void check_precision(Limits& limits, const Sums& prefix,
+                       std::uint64_t n_samples) const noexcept {
+    if (!(limits.rel_error > 0.) || 4 * prefix.n < n_samples ||
+        result_.n_iterations() + 1 < limits.min_iterations) {
+      return;
+    }
+    Result r = result_;
+    r.add(prefix.estimate());
+    if (r.error() <= limits.rel_error * std::abs(r.value())) {
+      limits.stop(Stop::rel_error);
+    }
+  }
+
+  /// close the profile of iteration `iteration` (see `profile()`)
+  void end_profile(std::uint64_t iteration, std::uint64_t n_samples) {
+    if constexpr (!profiling) return;
+    IterationProfile it;
+    it.iteration = iteration;
+    it.n_samples = n_samples;
+    for (Worker& wk : workers_) {
+      it.threads.push_back(wk.profile.times());
+      trace_.insert(trace_.end(), wk.profile.events.begin(),
+                    wk.profile.events.end());
+      wk.profile.clear();
+    }
+    profile_.push_back(std::move(it));
+  }
+
+  /// Evaluate chunk `c` of `n` points on worker `wk`; `fill` selects whether
+  /// the refinement histograms are filled, and `visit(wk)` is called for
+  /// every evaluated block.
+  template <typename F, typename Visit>
+  Sums run_chunk(F& f, Worker& wk, std::size_t c, std::uint64_t n, bool fill,
+                 Visit&& visit) {
+    TraceSpan span(wk.profile);
+    wk.rng.reset(opts_.seed, (iteration_ << 32) | std::uint64_t(c));
+    Sums sums;
+    const std::size_t cap = wk.batch.capacity();
+    // the points of an iteration run through the hypercubes in order
+    std::uint64_t point = std::uint64_t(c) * opts_.chunk_size;
+    std::size_t h = 0;
+    if (n_cubes_ > 1) {
+      h = wk.first_cube = chunk_cube_[c];
+      wk.cube_sums = cube_partials_.data() + chunk_partial_[c];
+    }
+    if (n_random_ > 0) {
+      if (opts_.sampling == Sampling::sobol) {
+        wk.sobol.reset(sobol_, opts_.seed, iteration_, point);
+      } else {
+        wk.lattice.reset(lattice_, opts_.seed, iteration_, point);
+      }
+      wk.first_cube = 0;
+      wk.cube_sums = cube_partials_.data() + c * n_random_;
+    }
+    for (std::uint64_t done = 0; done < n;) {
+      const std::size_t m = std::size_t(std::min<std::uint64_t>(cap, n - done));
+      if (n_cubes_ > 1) {
+        for (std::size_t i = 0; i < m; ++i, ++point) {
+          while (cube_start_[h + 1] <= point) ++h;
+          wk.cube[i] = std::uint32_t(h);
+        }
+      }
+      sample_block(wk, m);
+      Stopwatch watch(wk.profile);
+      f(static_cast<const batch_type&>(wk.batch), wk.values.data());
+      watch.lap(Stage::integrand);
+      accumulate_block(wk, sums, fill);
+      if (fill && opts_.defensive_adapt) {
+        accumulate_mix(wk, chunk_mix_.data() + c * n_mix);
+      }
+      visit(wk);
+      watch.lap(Stage::accumulation);
+      done += m;
+    }
+    span.close("chunk", std::size_t(&wk - workers_.data()), epoch_);
+    return sums;
+  }
+
+  /// chunks per scheduler task such that a task takes about
+  /// `Options::task_time` at the measured cost per point
+  std::uint32_t task_grain() const noexcept {
+    if (!(cost_ > 0.)) return 1;
+    const double grain = opts_.task_time / (cost_ * double(opts_.chunk_size));
+    return std::uint32_t(std::clamp(grain, 1., 65536.));
+  }
+
+  /// update the running estimate of the wall time per point of one worker
+  void update_cost(std::uint64_t n_samples) noexcept {
+    if (n_samples == 0) return;
+    double busy = 0.;
+    for (const Worker& wk : workers_) busy += wk.busy.count();
+    const double cost = busy / double(n_samples);
+    cost_ = cost_ > 0. ? 0.5 * (cost_ + cost) : cost;
+  }
+
+  /// Fix the histogram unit before the first iteration from a pilot run of
+  /// the first chunk, which is evaluated again as part of the iteration.
+  template <typename F>
+  void calibrate(F& f, std::uint64_t n) {
+    set_unit(run_chunk(f, workers_.front(), 0, n, false, [](Worker&) {}));
+  }
+
+  void set_unit(const Sums& sums) noexcept {
+    const double mean = sums.n > 0 ? sums.sum_abs / double(sums.n) : 0.;
+    quantizer_.set_unit(mean > 0. ? mean * unit_fraction : unit_fraction);
+    calibrated_ = true;
+  }
+
+  /// fill the worker's batch with `n` points drawn from the sampling density
+  void sample_block(Worker& wk, std::size_t n) noexcept {
+    const std::size_t nb = n_bins_;
+    batch_type& batch = wk.batch;
+    batch.resize(n);
+    Float* w = batch.weight();
+    Float* prob = wk.prob.data();
+    Stopwatch watch(wk.profile);
+    if (n_cubes_ > 1) {
+      // the density of the points allotted to their hypercube
+      for (std::size_t i = 0; i < n; ++i) w[i] = cube_weight_[wk.cube[i]];
+    } else {
+      std::fill_n(w, n, Float(1));
+    }
+    const std::size_t cap = batch.capacity();
+    if (opts_.sampling == Sampling::sobol) {
+      wk.sobol.fill(wk.quasi.data(), cap, n, wk.cube.data());
+    } else if (opts_.sampling == Sampling::lattice) {
+      wk.lattice.fill(wk.quasi.data(), cap, n, wk.cube.data());
+    }
+
+    // parents before children
+    for (const std::size_t d : order_) {
+      Float* u = wk.uniform.data();
+      if (n_random_ > 0) {
+        u = wk.quasi.data() + d * cap;
+      } else {
+        wk.rng.fill_uniform(u, n);
+      }
+      if (n_cubes_ > 1) {
+        const Float scale = Float(1) / Float(n_strata_);
+        for (std::size_t i = 0; i < n; ++i) {
+          const std::size_t k = wk.cube[i] / stride_[d] % n_strata_;
+          u[i] = (Float(k) + u[i]) * scale;
+        }
+      }
+      watch.lap(Stage::rng);
+      if (parent_[d] == npos) {
+        // all bins equally probable
+        simd::map_uniform(grids_[d].edges(), grids_[d].widths(), bin_type(nb),
+                          u, n, batch.x(d), batch.bin(d), w);
+        watch.lap(Stage::grid);
+        continue;
+      }
+      // bin conditional on the bin of the parent, drawn here, the map into
+      // the bins by the kernel
+      const bin_type* parent = batch.bin(parent_[d]);
+      bin_type* bin = batch.bin(d);
+      if (n_cubes_ == 1 && n_random_ == 0) {
+        // alias table: the integer part of u nb picks a column, which keeps
+        // its bin or gives its alias by the fraction, and the fraction
+        // rescaled is the uniform within the bin
+        const Float fnb = Float(nb);
+        for (std::size_t i = 0; i < n; ++i) {
+          const std::size_t row = block_[d] + parent[i] * nb;
+          const Float t = u[i] * fnb;
+          const bin_type k = std::min(bin_type(t), bin_type(nb - 1));
+          const Float frac = t - Float(k);
+          const Float keep = alias_prob_[row + k];
+          const bool own = frac < keep;
+          const bin_type b = own ? k : alias_[row + k];
+          const Float v = own ? frac / keep : (frac - keep) / (Float(1) - keep);
+          prob[i] = cond_[row + b];
+          u[i] = std::min(v, Float(1));
+          bin[i] = b;
+        }
+        watch.lap(Stage::conditional);
+        simd::map_bins(grids_[d].edges(), grids_[d].widths(), bin, u, prob, n,
+                       batch.x(d), w);
+        watch.lap(Stage::grid);
+        continue;
+      }
+      // stratified or quasi-Monte Carlo points: the CDF inversion is
+      // monotone in u and keeps the strata in order and the points evenly
+      // spread
+      for (std::size_t i = 0; i < n; ++i) {
+        const std::size_t row = block_[d] + parent[i] * nb;
+        const Float* cdf = cdf_.data() + row;
+        const Float r = u[i];
+        const bin_type b =
+            std::min(bin_type(std::upper_bound(cdf, cdf + nb, r) - cdf),
+                     bin_type(nb - 1));
+        const Float lo = b > 0 ? cdf[b - 1] : Float(0);
+        prob[i] = cond_[row + b];
+        u[i] = std::min((r - lo) / prob[i], Float(1));
+        bin[i] = b;
+      }
+      watch.lap(Stage::conditional);
+      simd::map_bins(grids_[d].edges(), grids_[d].widths(), bin, u, prob, n,
+                     batch.x(d), w);
+      watch.lap(Stage::grid);
+    }
+    if (mix_ > 0.) {
+      mix_block(wk, n);
+      watch.lap(Stage::grid);
+    }
+  }
+
+  /// Defensive mixture: draw the points of the block that fall to the safe
+  /// density anew from it, and weight all points with the inverse of the
+  /// mixture density.
+  void mix_block(Worker& wk, std::size_t n) noexcept {
+    const std::size_t nb = n_bins_;
+    batch_type& batch = wk.batch;
+    Float* u = wk.uniform.data();
+    wk.rng.fill_uniform(u, n);
+    wk.picked.clear();
+    for (std::size_t i = 0; i < n; ++i) {
+      if (double(u[i]) < mix_) wk.picked.push_back(std::uint32_t(i));
+    }
+    const std::size_t m = wk.picked.size();
+    const bool uniform = opts_.defensive_density == Defensive::uniform;
+    for (std::size_t d = 0; d < Dim; ++d) {
+      const Grid<Float>& g = grids_[d];
+      Float* x = batch.x(d);
+      bin_type* bin = batch.bin(d);
+      wk.rng.fill_uniform(u, m);
+      for (std::size_t k = 0; k < m; ++k) {
+        const std::size_t i = wk.picked[k];
+        if (uniform) {
+          x[i] = u[k];
+          bin[i] = bin_type(g.find(u[k]));
+          continue;
+        }
+        // all bins equally probable, as for a dimension without parent
+        const Float t = u[k] * Float(nb);
+        const bin_type b = std::min(bin_type(t), bin_type(nb - 1));
+        bin[i] = b;
+        x[i] = g.edge(b) + std::min(t - Float(b), Float(1)) * g.width(b);
+      }
+    }
+    Float* w = batch.weight();
+    std::array<bin_type, Dim> bins;
+    for (std::size_t i = 0; i < n; ++i) {
+      for (std::size_t d = 0; d < Dim; ++d) bins[d] = batch.bin(d)[i];
+      const auto [p, safe] = densities(bins);
+      wk.dens[i] = p;
+      wk.safe[i] = safe;
+      w[i] = Float(1. / ((1. - mix_) * p + mix_ * safe));
+    }
+  }
+
+  /// density of the grids and tables, and the safe density of the
+  /// defensive mixture, at a point in the bins `bin`
+  std::pair<double, double> densities(
+      const std::array<bin_type, Dim>& bin) const noexcept {
+    const double nb = double(n_bins_);
+    // the 1D grids alone, and the tables relative to uniform bins
+    double grids = 1., tables = 1.;
+    for (std::size_t d = 0; d < Dim; ++d) {
+      grids /= nb * double(grids_[d].width(bin[d]));
+      if (parent_[d] == npos) continue;
+      tables *= nb * double(conditional(d, bin[parent_[d]], bin[d]));
+    }
+    const bool uniform = opts_.defensive_density == Defensive::uniform;
+    return {grids * tables, uniform ? 1. : grids};
+  }
+
+  /// Add the second moments of |f w| that the block would have had with
+  /// every candidate fraction of the defensive mixture to `out`: the
+  /// points are reweighted by the ratio of the mixture densities.
+  void accumulate_mix(const Worker& wk, double* out) const noexcept {
+    const std::size_t n = wk.batch.size();
+    const Float* w = wk.batch.weight();
+    for (std::size_t i = 0; i < n; ++i) {
+      const double fw = double(wk.values[i]) * double(w[i]);
+      if (fw == 0.) continue;
+      const double p = wk.dens[i], safe = wk.safe[i];
+      const double q = (1. - mix_) * p + mix_ * safe;
+      for (std::size_t k = 0; k < n_mix; ++k) {
+        const double qk = (1. - mix_fractions[k]) * p + mix_fractions[k] * safe;
+        out[k] += fw * fw * q / qk;
+      }
+    }
+  }
+
+  /// the candidate fraction of least variance since the last refinement
+  void refine_mix() {
+    if (!opts_.defensive_adapt) return;
+    const auto best =
+        std::min_element(pending_mix_.begin(), pending_mix_.end());
+    if (*best > 0. && std::isfinite(*best)) {
+      mix_ = mix_fractions[std::size_t(best - pending_mix_.begin())];
+    }
+    std::fill(pending_mix_.begin(), pending_mix_.end(), 0.);
+  }
+
+  /// add the worker's block to `sums` and (with `fill`) its histograms
+  void accumulate_block(Worker& wk, Sums& sums, bool fill) noexcept {
+    const std::size_t nb = n_bins_;
+    const batch_type& batch = wk.batch;
+    const std::size_t n = batch.size();
+    const Float* w = batch.weight();
+    const Float* values = wk.values.data();
+    Quantizer::value_type* imp = wk.importance.data();
+    for (std::size_t i = 0; i < n; ++i) {
+      const double fw = double(values[i]) * double(w[i]);
+      sums.add(fw);
+      imp[i] = quantizer_.quantize(std::abs(fw));
+    }
+    if (n_cubes_ > 1 || n_random_ > 0) {
+      for (std::size_t i = 0; i < n; ++i) {
+        wk.cube_sums[wk.cube[i] - wk.first_cube].add(double(values[i]) *
+                                                     double(w[i]));
+      }
+    }
+    if (!fill) return;
+    if (opts_.weight_sketch) {
+      for (std::size_t i = 0; i < n; ++i) {
+        wk.weights.add(double(values[i]) * double(w[i]));
+      }
+    }
+    for (std::size_t d = 0; d < Dim; ++d) {
+      Quantizer::value_type* acc = wk.acc.one.data() + d * nb;
+      const bin_type* bin = batch.bin(d);
+      for (std::size_t i = 0; i < n; ++i) {
+        acc[bin[i]] = Quantizer::add(acc[bin[i]], imp[i]);
+      }
+    }
+    if (sort_pairs_) {
+      accumulate_sorted(wk);
+      return;
+    }
+    for (std::size_t p = 0; p < layout_.size(); ++p) {
+      const std::size_t block = layout_.offset(p);
+      const bin_type* first = batch.bin(layout_.first(p));
+      const bin_type* second = batch.bin(layout_.second(p));
+      if (wk.acc.sparse) {
+        for (std::size_t i = 0; i < n; ++i) {
+          if (imp[i] == 0) continue;
+          wk.acc.sparse_pair.add(
+              std::uint32_t(block + std::size_t(first[i]) * nb + second[i]),
+              imp[i]);
+        }
+        continue;
+      }
+      Quantizer::value_type* acc = wk.acc.pair.data() + block;
+      for (std::size_t i = 0; i < n; ++i) {
+        const std::size_t cell = std::size_t(first[i]) * nb + second[i];
+        acc[cell] = Quantizer::add(acc[cell], imp[i]);
+      }
+    }
+  }
+
+  /// Add the block to the pair histograms by sort-then-reduce: for every
+  /// pair the (cell, count) pairs are radix sorted by cell and every run of
+  /// equal cells is added at once, walking the histogram block in address
+  /// order instead of scattering into it.
+  void accumulate_sorted(Worker& wk) {
+    const std::size_t nb = n_bins_;
+    const batch_type& batch = wk.batch;
+    const std::size_t n = batch.size();
+    const Quantizer::value_type* imp = wk.importance.data();
+    for (std::size_t p = 0; p < layout_.size(); ++p) {
+      const std::size_t block = layout_.offset(p);
+      const bin_type* first = batch.bin(layout_.first(p));
+      const bin_type* second = batch.bin(layout_.second(p));
+      std::size_t m = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        if (imp[i] == 0) continue;
+        wk.cells[m] = std::uint32_t(std::size_t(first[i]) * nb + second[i]);
+        wk.counts[m++] = imp[i];
+      }
+      radix_sort(wk.cells, wk.counts, wk.cells_tmp, wk.counts_tmp, wk.buckets,
+                 m, cell_bits_);
+      const std::uint32_t* cells = wk.cells.data();
+      const Quantizer::value_type* counts = wk.counts.data();
+      for (std::size_t k = 0; k < m;) {
+        const std::uint32_t cell = cells[k];
+        Quantizer::value_type v = counts[k];
+        while (++k < m && cells[k] == cell) v = Quantizer::add(v, counts[k]);
+        if (wk.acc.sparse) {
+          wk.acc.sparse_pair.add(std::uint32_t(block + cell), v);
+        } else {
+          Quantizer::value_type& c = wk.acc.pair[block + cell];
+          c = Quantizer::add(c, v);
+        }
+      }
+    }
+  }
+
+  /// Choose the strata of an iteration of `n_samples` points (see
+  /// `strata_for`) and the points of each hypercube (a range of the point
+  /// indices) from the allocation weights.  A change of the number of
+  /// strata restarts the allocation from equal weights.
+  void allocate_strata(std::uint64_t n_samples) {
+    const std::size_t ns = strata_for(n_samples);
+    if (ns != n_strata_) set_strata(ns);
+    if (n_cubes_ == 1) {
+      if (n_random_ == 0) cube_partials_.clear();
+      return;
+    }
+    split_points(n_samples, strata_weight_, cube_start_);
+    for (std::size_t h = 0; h < n_cubes_; ++h) {
+      const double nh = double(cube_start_[h + 1] - cube_start_[h]);
+      cube_weight_[h] = Float(double(n_samples) / (double(n_cubes_) * nh));
+    }
+    cube_partials_.resize(
+        chunk_partials(n_samples, cube_start_, chunk_cube_, chunk_partial_));
+  }
+
+  /// strata per dimension of an iteration of `n_samples` points: as many
+  /// as fit the limits of `Options::max_strata` and two points per
+  /// hypercube (1 without `Options::stratify`)
+  std::size_t strata_for(std::uint64_t n_samples) const {
+    if (!opts_.stratify) return 1;
+    const std::uint64_t limit =
+        std::min<std::uint64_t>(n_samples / 2, opts_.max_strata);
+    // ns^Dim, saturated above `limit`
+    const auto cubes = [limit](std::uint64_t k) {
+      std::uint64_t c = 1;
+      for (std::size_t d = 0; d < Dim && c <= limit; ++d) c *= k;
+      return c;
+    };
+    std::size_t ns = std::size_t(
+        std::max(1., std::floor(std::pow(double(limit), 1. / double(Dim)))));
+    while (ns > 1 && cubes(ns) > limit) --ns;
+    while (cubes(ns + 1) <= limit) ++ns;
+    return ns;
+  }
+
+  /// Cumulative rounding of `n_samples` points to the hypercubes in
+  /// proportion to `weight`, with at least two per hypercube: the first
+  /// point of every hypercube and the end in `start` [n_cubes + 1].
+  static void split_points(std::uint64_t n_samples,
+                           const std::vector<double>& weight,
+                           std::vector<std::uint64_t>& start) {
+    const std::size_t n_cubes = weight.size();
+    double total = 0.;
+    for (const double x : weight) total += x;
+    const double spare = double(n_samples - 2 * n_cubes);
+    start.assign(n_cubes + 1, 0);
+    double c = 0.;
+    for (std::size_t h = 0; h < n_cubes; ++h) {
+      c += 2. + spare * weight[h] / total;
+      start[h + 1] = std::min(std::uint64_t(std::floor(c + 0.5)), n_samples);
+    }
+    start[n_cubes] = n_samples;
+  }
+
+  /// The first hypercube touched by every chunk in `first` and the offsets
+  /// of their partial sums in `offset` [n_chunks + 1] for the hypercubes
+  /// starting at `start`; returns the number of partial sums.
+  std::size_t chunk_partials(std::uint64_t n_samples,
+                             const std::vector<std::uint64_t>& start,
+                             std::vector<std::size_t>& first,
+                             std::vector<std::size_t>& offset) const {
+    const std::uint64_t chunk = opts_.chunk_size;
+    const std::size_t n_chunks = std::size_t((n_samples + chunk - 1) / chunk);
+    first.resize(n_chunks);
+    offset.assign(n_chunks + 1, 0);
+    std::size_t h = 0;
+    for (std::size_t k = 0; k < n_chunks; ++k) {
+      const std::uint64_t begin = k * chunk;
+      const std::uint64_t last = std::min(n_samples, begin + chunk) - 1;
+      while (start[h + 1] <= begin) ++h;
+      std::size_t h_last = h;
+      while (start[h_last + 1] <= last) ++h_last;
+      first[k] = h;
+      offset[k + 1] = offset[k] + (h_last - h + 1);
+    }
+    return offset[n_chunks];
+  }
+
+  /// Throw `std::runtime_error` unless the strata of `c` and the chunks of
+  /// its iteration in progress have the sizes that this integrator gives
+  /// them: the allocation weights and variances one per hypercube, and
+  /// the finished chunks, their sums, mixture moments and partial sums
+  /// those of `ceil(n_samples / chunk_size)` chunks.
+  void check_chunks(const Checkpoint& c) const {
+    const auto fail = [](const char* what) {
+      throw std::runtime_error(
+          std::string("kakuhen::Integrator::resume: ") + what);
+    };
+    if (c.n_strata < 1 || (!opts_.stratify && c.n_strata != 1) ||
+        std::pow(double(c.n_strata), double(Dim)) >
+            double(std::max<std::size_t>(opts_.max_strata, 1))) {
+      fail("number of strata out of range");
+    }
+    std::size_t n_cubes = 1;
+    for (std::size_t d = 0; d < Dim; ++d) n_cubes *= std::size_t(c.n_strata);
+    if (c.strata_weight.size() != n_cubes ||
+        c.strata_var.size() != n_cubes) {
+      fail("strata of the wrong size");
+    }
+    double total = 0.;
+    for (const double x : c.strata_weight) {
+      if (!(x >= 0.)) fail("negative allocation weight");
+      total += x;
+    }
+    if (!(total > 0.) || !std::isfinite(total)) {
+      fail("allocation weights out of range");
+    }
+    if (c.n_samples > 0 && c.n_strata != strata_for(c.n_samples)) {
+      fail("strata do not match the iteration in progress");
+    }
+
+    const std::uint64_t chunk = opts_.chunk_size;
+    const std::uint64_t n_chunks = (c.n_samples + chunk - 1) / chunk;
+    std::uint64_t n_partials = 0;
+    if (c.n_samples > 0 && n_random_ > 0) {
+      n_partials = n_chunks * n_random_;
+    } else if (c.n_samples > 0 && n_cubes > 1) {
+      std::vector<std::uint64_t> start;
+      std::vector<std::size_t> first, offset;
+      split_points(c.n_samples, c.strata_weight, start);
+      n_partials = chunk_partials(c.n_samples, start, first, offset);
+    }
+    if (c.done.size() != n_chunks || c.chunk_sums.size() != n_chunks ||
+        c.chunk_mix.size() != (opts_.defensive_adapt ? n_chunks * n_mix : 0) ||
+        c.cube_partials.size() != n_partials) {
+      fail("chunks do not match the iteration in progress");
+    }
+  }
+
+  /// `ns` strata per dimension with equal allocation weights
+  void set_strata(std::size_t ns) {
+    n_strata_ = ns;
+    n_cubes_ = 1;
+    for (std::size_t d = 0; d < Dim; ++d) {
+      stride_[d] = n_cubes_;
+      n_cubes_ *= ns;
+    }
+    strata_weight_.assign(n_cubes_, 1.);
+    strata_var_.assign(n_cubes_, 0.);
+    cube_weight_.assign(n_cubes_, Float(1));
+    cube_sums_.assign(n_cubes_, Sums{});
+    cube_start_.assign(n_cubes_ + 1, 0);
+  }
+
+  /// Merge the partial sums of the chunks per hypercube (in chunk order),
+  /// add the variance of every hypercube to `strata_var_` and return the
+  /// error of the stratified estimate.
+  double reduce_strata(std::uint64_t n_samples) {
+    std::fill(cube_sums_.begin(), cube_sums_.end(), Sums{});
+    for (std::size_t k = 0; k + 1 < chunk_partial_.size(); ++k) {
+      for (std::size_t j = chunk_partial_[k]; j < chunk_partial_[k + 1]; ++j) {
+        cube_sums_[chunk_cube_[k] + (j - chunk_partial_[k])] +=
+            cube_partials_[j];
+      }
+    }
+    const double dn = double(n_samples);
+    double var = 0.;
+    for (std::size_t h = 0; h < n_cubes_; ++h) {
+      const Sums& sh = cube_sums_[h];
+      if (sh.n < 2) continue;
+      const double nh = double(sh.n);
+      const double s2 =
+          std::max(sh.sum2 - sh.sum * sh.sum / nh, 0.) / (nh - 1.);
+      // variance of the hypercube's share of the estimate, and (times n_h)
+      // the variance per point that drives the allocation
+      const double v = nh * s2 / (dn * dn);
+      var += v;
+      strata_var_[h] += nh * v;
+    }
+    return std::sqrt(var);
+  }
+
+  /// new allocation weights from the variances since the last refinement
+  void refine_strata() {
+    if (n_cubes_ == 1) return;
+    double total = 0.;
+    for (std::size_t h = 0; h < n_cubes_; ++h) {
+      strata_weight_[h] = std::pow(strata_var_[h], 0.5 * opts_.strata_beta);
+      total += strata_weight_[h];
+    }
+    if (!(total > 0.) || !std::isfinite(total)) {
+      std::fill(strata_weight_.begin(), strata_weight_.end(), 1.);
+    }
+    std::fill(strata_var_.begin(), strata_var_.end(), 0.);
+  }
+
+  /// Size the partial sums of the randomisations of the quasi-Monte Carlo
+  /// points for an iteration of `n_samples` points: every chunk holds
+  /// points of all of them, at `c * n_random_` in `cube_partials_`.  Throws
+  /// `std::invalid_argument` unless every randomisation gets at least two
+  /// and less than 2^32 points.
+  void allocate_randomizations(std::uint64_t n_samples) {
+    if (n_random_ == 0) return;
+    if (n_samples < 2 * n_random_ ||
+        n_samples / n_random_ >= std::uint64_t(1) << SobolSequence::bits) {
+      throw std::invalid_argument(
+          "kakuhen::Integrator: an iteration of quasi-Monte Carlo points "
+          "needs two to 2^32 points per randomisation");
+    }
+    const std::uint64_t chunk = opts_.chunk_size;
+    const std::size_t n_chunks = std::size_t((n_samples + chunk - 1) / chunk);
+    cube_partials_.resize(n_chunks * n_random_);
+  }
+
+  /// Merge the partial sums of the chunks per randomisation (in chunk
+  /// order) and return the error of the iteration from the spread of the
+  /// estimates of the randomisations.
+  double reduce_randomizations() const {
+    std::vector<Sums> sums(n_random_);
+    for (std::size_t j = 0; j < cube_partials_.size(); ++j) {
+      sums[j % n_random_] += cube_partials_[j];
+    }
+    const double r = double(n_random_);
+    double mean = 0.;
+    for (const Sums& s : sums) mean += s.sum / double(s.n);
+    mean /= r;
+    double var = 0.;
+    for (const Sums& s : sums) {
+      const double delta = s.sum / double(s.n) - mean;
+      var += delta * delta;
+    }
+    return std::sqrt(var / (r * (r - 1.)));
+  }
+
+  /// whether the conditional bins are drawn by inverting the CDF of their
+  /// row instead of from the alias table
+  static bool inverts(const Options& opts) noexcept {
+    return opts.stratify || opts.sampling != Sampling::random;
+  }
+
+  /// generating vector of the lattice points, built once per dimension
+  static const LatticeRule& lattice_rule() {
+    static const LatticeRule rule(Dim);
+    return rule;
+  }
+
+  /// merge the worker histograms into `acc1_` and `accp_` (and into those of
+  /// the first worker, clearing the others)
+  void reduce() {
+    Accumulator& total = workers_.front().acc;
+    for (std::size_t w = 1; w < workers_.size(); ++w) {
+      total += workers_[w].acc;
+      workers_[w].acc.clear();
+    }
+    for (std::size_t i = 0; i < acc1_.size(); ++i) {
+      acc1_[i] = quantizer_.value(total.one[i]);
+    }
+    std::fill(accp_.begin(), accp_.end(), 0.);
+    total.for_each_pair([this](std::uint32_t cell, Quantizer::value_type q) {
+      accp_[cell] = quantizer_.value(q);
+    });
+    reduce_sketches();
+  }
+
+  /// move the weight sketches of the workers into `sketch_`
+  void reduce_sketches() {
+    for (Worker& wk : workers_) {
+      sketch_ += wk.weights;
+      wk.weights.clear();
+    }
+  }
+
+  /// pairs stored initially: the chain, the given pairs, all pairs to
+  /// learn the tree from, or none
+  static PairLayout initial_layout(const Options& opts) {
+    switch (opts.structure) {
+      case Structure::chain:
+        break;
+      case Structure::none:
+        return PairLayout(Dim, opts.n_bins, {});
+      case Structure::pairs: {
+        std::vector<PairLayout::pair_type> pairs;
+        for (const auto& [i, j] : opts.pairs) {
+          pairs.emplace_back(std::min(i, j), std::max(i, j));
+        }
+        return PairLayout(Dim, opts.n_bins, std::move(pairs));
+      }
+      case Structure::tree: {
+        std::vector<PairLayout::pair_type> pairs;
+        for (std::uint32_t j = 1; j < Dim; ++j) {
+          for (std::uint32_t i = 0; i < j; ++i) pairs.emplace_back(i, j);
+        }
+        return PairLayout(Dim, opts.n_bins, std::move(pairs));
+      }
+    }
+    return PairLayout::chain(Dim, opts.n_bins);
+  }
+
+  /// edges of the forest before any refinement: the stored pairs, except
+  /// for a tree that is still to be learned, which starts as the chain
+  std::vector<PairLayout::pair_type> initial_edges() const {
+    std::vector<PairLayout::pair_type> edges;
+    if (opts_.structure == Structure::tree) {
+      for (std::uint32_t d = 1; d < Dim; ++d) edges.emplace_back(d - 1, d);
+      return edges;
+    }
+    // union-find: every pair has to join two separate trees
+    std::array<std::size_t, Dim> root;
+    for (std::size_t d = 0; d < Dim; ++d) root[d] = d;
+    const auto find = [&root](std::size_t d) {
+      while (root[d] != d) d = root[d] = root[root[d]];
+      return d;
+    };
+    for (std::size_t p = 0; p < layout_.size(); ++p) {
+      const std::size_t a = find(layout_.first(p));
+      const std::size_t b = find(layout_.second(p));
+      if (a == b) {
+        throw std::invalid_argument("kakuhen::Integrator: pairs form a cycle");
+      }
+      root[a] = b;
+      edges.push_back(layout_.pair(p));
+    }
+    return edges;
+  }
+
+  bool learning() const noexcept {
+    return opts_.structure == Structure::tree &&
+           (opts_.tree_updates == 0 || refinements_ < opts_.tree_updates);
+  }
+
+  /// Orient the forest `edges`: every tree is rooted at its lowest dimension
+  /// and traversed breadth first.
+  void set_parents(const std::vector<PairLayout::pair_type>& edges) {
+    std::vector<std::vector<std::size_t>> adjacent(Dim);
+    for (const auto& [i, j] : edges) {
+      adjacent[i].push_back(j);
+      adjacent[j].push_back(i);
+    }
+    std::array<std::size_t, Dim> parents;
+    parents.fill(npos);
+    std::array<bool, Dim> seen{};
+    std::vector<std::size_t> queue;
+    for (std::size_t root = 0; root < Dim; ++root) {
+      if (seen[root]) continue;
+      seen[root] = true;
+      queue.assign(1, root);
+      for (std::size_t k = 0; k < queue.size(); ++k) {
+        for (const std::size_t c : adjacent[queue[k]]) {
+          if (seen[c]) continue;
+          seen[c] = true;
+          parents[c] = queue[k];
+          queue.push_back(c);
+        }
+      }
+    }
+    orient(parents);
+    update_blocks();
+  }
+
+  /// Set `parent_` and the sampling order `order_`: roots in increasing
+  /// order, each followed breadth first by its tree with children in
+  /// increasing order.  Throws `std::invalid_argument` if
+  /// `parents` contains a cycle.
+  void orient(const std::array<std::size_t, Dim>& parents) {
+    std::array<std::size_t, Dim> order;
+    std::size_t n = 0;
+    for (std::size_t root = 0; root < Dim; ++root) {
+      if (parents[root] != npos) continue;
+      order[n++] = root;
+      for (std::size_t k = n - 1; k < n; ++k) {
+        for (std::size_t c = 0; c < Dim; ++c) {
+          if (parents[c] == order[k]) order[n++] = c;
+        }
+      }
+    }
+    if (n != Dim) {
+      throw std::invalid_argument("kakuhen::Integrator: parents form a cycle");
+    }
+    parent_ = parents;
+    order_ = order;
+  }
+
+  void update_blocks() noexcept {
+    for (std::size_t d = 0; d < Dim; ++d) {
+      const std::size_t q = parent_[d];
+      block_[d] = q == npos ? npos
+                            : layout_.offset(layout_.slot(std::min(q, d),
+                                                          std::max(q, d)));
+    }
+  }
+
+  /// Maximum spanning tree (Prim) of the mutual information between the
+  /// bins of two dimensions, estimated from the two-point histograms of all
+  /// pairs.
+  std::vector<PairLayout::pair_type> chow_liu() const {
+    const std::size_t nb = n_bins_;
+    std::vector<double> info(Dim * Dim, 0.);
+    std::vector<double> rows(nb), cols(nb);
+    for (std::size_t p = 0; p < layout_.size(); ++p) {
+      const double* h = accp_.data() + layout_.offset(p);
+      std::fill(rows.begin(), rows.end(), 0.);
+      std::fill(cols.begin(), cols.end(), 0.);
+      double total = 0.;
+      for (std::size_t a = 0; a < nb; ++a) {
+        for (std::size_t b = 0; b < nb; ++b) {
+          rows[a] += h[a * nb + b];
+          cols[b] += h[a * nb + b];
+        }
+        total += rows[a];
+      }
+      double mi = 0.;
+      if (total > 0. && std::isfinite(total)) {
+        for (std::size_t a = 0; a < nb; ++a) {
+          for (std::size_t b = 0; b < nb; ++b) {
+            const double v = h[a * nb + b];
+            if (v > 0.) mi += v * std::log(v * total / (rows[a] * cols[b]));
+          }
+        }
+        mi /= total;
+      }
+      const std::size_t i = layout_.first(p), j = layout_.second(p);
+      info[i * Dim + j] = info[j * Dim + i] = mi;
+    }
+
+    std::vector<PairLayout::pair_type> edges;
+    std::array<bool, Dim> in_tree{};
+    std::array<double, Dim> best;
+    std::array<std::size_t, Dim> link{};
+    best.fill(-1.);
+    in_tree[0] = true;
+    for (std::size_t d = 1; d < Dim; ++d) best[d] = info[d];
+    for (std::size_t k = 1; k < Dim; ++k) {
+      std::size_t next = npos;
+      for (std::size_t d = 0; d < Dim; ++d) {
+        if (!in_tree[d] && (next == npos || best[d] > best[next])) next = d;
+      }
+      in_tree[next] = true;
+      edges.emplace_back(std::uint32_t(std::min(next, link[next])),
+                         std::uint32_t(std::max(next, link[next])));
+      for (std::size_t d = 0; d < Dim; ++d) {
+        if (!in_tree[d] && info[next * Dim + d] > best[d]) {
+          best[d] = info[next * Dim + d];
+          link[d] = next;
+        }
+      }
+    }
+    return edges;
+  }
+
+  /// Update the conditional tables from the two-point histograms; a
+  /// dimension whose parent differs from `previous` starts from scratch.
+  /// The histogram is averaged over the 3x3 neighbourhood of each cell
+  /// first: a table has n_bins times fewer points per cell than a grid
+  /// has per bin, and the noise of single cells otherwise starves cells
+  /// next to the peaks and leaves heavy tails in the weights.
+  void refine_tables(const std::array<std::size_t, Dim>& previous) {
+    const std::size_t nb = n_bins_;
+    const double floor = opts_.pair_floor;
+    std::vector<double> est(nb * nb);
+    for (std::size_t d = 0; d < Dim; ++d) {
+      const std::size_t q = parent_[d];
+      if (q == npos) continue;
+      const bool fresh = previous[d] != q;
+      const double damp = fresh ? 1. : opts_.pair_damping;
+      // the histograms are [lower dimension][higher dimension]
+      const std::size_t step_parent = q < d ? nb : 1;
+      const std::size_t step_child = q < d ? 1 : nb;
+      const double* h = accp_.data() + block_[d];
+      Float* cond = cond_.data() + block_[d];
+      if (fresh) std::fill_n(cond, nb * nb, Float(1) / Float(nb));
+      for (std::size_t bp = 0; bp < nb; ++bp) {
+        const std::size_t p0 = bp > 0 ? bp - 1 : 0;
+        const std::size_t p1 = std::min(bp + 2, nb);
+        for (std::size_t b = 0; b < nb; ++b) {
+          const std::size_t b0 = b > 0 ? b - 1 : 0;
+          const std::size_t b1 = std::min(b + 2, nb);
+          double sum = 0.;
+          for (std::size_t i = p0; i < p1; ++i) {
+            for (std::size_t j = b0; j < b1; ++j) {
+              sum += h[i * step_parent + j * step_child];
+            }
+          }
+          est[bp * nb + b] = sum / double((p1 - p0) * (b1 - b0));
+        }
+      }
+      for (std::size_t bp = 0; bp < nb; ++bp) {
+        double sum = 0.;
+        for (std::size_t b = 0; b < nb; ++b) sum += est[bp * nb + b];
+        if (!(sum > 0.) || !std::isfinite(sum)) continue;
+        for (std::size_t b = 0; b < nb; ++b) {
+          const double mixed = (1. - damp) * double(cond[bp * nb + b]) +
+                               damp * est[bp * nb + b] / sum;
+          cond[bp * nb + b] =
+              Float((1. - floor) * mixed + floor / double(nb));
+        }
+      }
+    }
+  }
+
+  /// drop the tables and histograms of all pairs outside the learned tree
+  void freeze_tree() {
+    const std::size_t block = layout_.block_size();
+    std::vector<Float> tables;
+    for (std::size_t d = 0; d < Dim; ++d) {
+      if (parent_[d] == npos) continue;
+      tables.insert(tables.end(), cond_.begin() + block_[d],
+                    cond_.begin() + block_[d] + block);
+    }
+    set_forest(tables.data());
+  }
+
+  /// Store exactly the pairs of the current parents, with the tables taken
+  /// from `tables` (one block per dimension with a parent, in increasing
+  /// order of the dimension), and reset the pair histograms.
+  void set_forest(const Float* tables) {
+    std::vector<PairLayout::pair_type> edges;
+    for (std::size_t d = 0; d < Dim; ++d) {
+      if (parent_[d] == npos) continue;
+      edges.emplace_back(std::uint32_t(std::min(d, parent_[d])),
+                         std::uint32_t(std::max(d, parent_[d])));
+    }
+    layout_ = PairLayout(Dim, n_bins_, std::move(edges));
+    update_blocks();
+    cond_.assign(layout_.n_cells(), Float(0));
+    for (std::size_t d = 0, k = 0; d < Dim; ++d) {
+      if (parent_[d] == npos) continue;
+      std::copy_n(tables + k++ * layout_.block_size(), layout_.block_size(),
+                  cond_.begin() + block_[d]);
+    }
+    alias_prob_.assign(cond_.size(), Float(0));
+    alias_.assign(cond_.size(), 0);
+    cdf_.assign(inverts(opts_) ? cond_.size() : 0, Float(0));
+    for (std::size_t d = 0; d < Dim; ++d) update_sampling(d);
+    accp_.assign(cond_.size(), 0.);
+    for (Worker& wk : workers_) {
+      wk.acc = Accumulator(acc1_.size(), accp_.size(), opts_.sparse_pairs);
+    }
+    set_accumulation();
+  }
+
+  /// Rebuild the sampling tables of the rows of dimension `d` from
+  /// `cond_`: the Walker alias tables (Vose's construction) and, with
+  /// stratification, the CDF.
+  void update_sampling(std::size_t d) {
+    if (parent_[d] == npos) return;
+    const std::size_t nb = n_bins_;
+    std::vector<double> scaled(nb);
+    std::vector<bin_type> small, large;
+    small.reserve(nb);
+    large.reserve(nb);
+    for (std::size_t bp = 0; bp < nb; ++bp) {
+      const std::size_t row = block_[d] + bp * nb;
+      small.clear();
+      large.clear();
+      for (std::size_t b = 0; b < nb; ++b) {
+        scaled[b] = double(cond_[row + b]) * double(nb);
+        (scaled[b] < 1. ? small : large).push_back(bin_type(b));
+      }
+      // pair every under-full bin with an over-full one that fills it up
+      while (!small.empty() && !large.empty()) {
+        const bin_type s = small.back(), l = large.back();
+        small.pop_back();
+        large.pop_back();
+        alias_prob_[row + s] = Float(scaled[s]);
+        alias_[row + s] = l;
+        scaled[l] -= 1. - scaled[s];
+        (scaled[l] < 1. ? small : large).push_back(l);
+      }
+      // the rest are full up to rounding
+      for (const bin_type b : small) {
+        alias_prob_[row + b] = Float(1);
+        alias_[row + b] = b;
+      }
+      for (const bin_type b : large) {
+        alias_prob_[row + b] = Float(1);
+        alias_[row + b] = b;
+      }
+    }
+    if (cdf_.empty()) return;
+    for (std::size_t bp = 0; bp < nb; ++bp) {
+      const std::size_t row = block_[d] + bp * nb;
+      Float c = Float(0);
+      for (std::size_t b = 0; b < nb; ++b) {
+        c += cond_[row + b];
+        cdf_[row + b] = c;
+      }
+      cdf_[row + nb - 1] = Float(1);
+    }
+  }
+
+  Options opts_;
+  std::size_t n_bins_;
+  std::array<Grid<Float>, Dim> grids_;
+  PairLayout layout_;
+  /// parent of every dimension, sampling order and first cell of the table
+  /// of every dimension with a parent
+  std::array<std::size_t, Dim> parent_;
+  std::array<std::size_t, Dim> order_;
+  std::array<std::size_t, Dim> block_;
+  /// number of refinements so far
+  std::size_t refinements_ = 0;
+  /// conditional bin probabilities per stored pair [parent bin][bin], their
+  /// alias tables (probability to keep bin `b` of a row, else its alias)
+  /// and, for the stratified sampling, their CDF
+  std::vector<Float> cond_;
+  std::vector<Float> alias_prob_;
+  std::vector<bin_type> alias_;
+  std::vector<Float> cdf_;
+  /// merged importance per 1D bin [dim][bin] and per pair cell
+  std::vector<double> acc1_;
+  std::vector<double> accp_;
+  /// merged weight sketch since the last refinement
+  WeightSketch sketch_;
+
+  std::shared_ptr<ThreadPool> pool_;
+  std::vector<Worker> workers_;
+  WorkStealingScheduler scheduler_;
+  /// measured wall time per point and worker in seconds (0: unknown)
+  double cost_ = 0.;
+  std::vector<Sums> chunk_sums_;
+  Quantizer quantizer_;
+  /// pair histograms filled by sort-then-reduce, over `cell_bits_` bits
+  /// of the cell within the block of a pair
+  bool sort_pairs_ = false;
+  unsigned cell_bits_ = 0;
+  bool calibrated_ = false;
+  /// sums of all iterations since the last refinement
+  Sums pending_;
+  /// number of iterations run so far; labels the random streams
+  std::uint64_t iteration_ = 0;
+  /// finished chunks of the current iteration, its points while it runs
+  /// and those of an iteration to be completed after `resume`
+  std::vector<std::uint8_t> chunk_done_;
+  std::uint64_t current_n_ = 0;
+  std::uint64_t resume_n_ = 0;
+  /// per chunk of an iteration with limits: its refinement data until the
+  /// chunk joins the prefix (see `ChunkData`)
+  std::vector<std::unique_ptr<ChunkData>> held_;
+  /// progress of `run`, kept for checkpoints
+  struct RunState {
+    bool active = false;
+    std::uint64_t n = 0;
+    double previous = 0.;
+    std::size_t iterations = 0;
+    std::uint64_t samples = 0;
+    double wall = 0.;
+    double cpu = 0.;
+  } run_;
+  /// periodic checkpoints: the time of the next, the write in progress and
+  /// the error of the last one
+  std::chrono::steady_clock::time_point next_checkpoint_;
+  std::future<void> writer_;
+  std::exception_ptr checkpoint_error_;
+  /// stage times per iteration and the trace events of all iterations,
+  /// timed from `epoch_` (`KAKUHEN_PROFILE` only)
+  std::vector<IterationProfile> profile_;
+  std::vector<TraceEvent> trace_;
+  std::chrono::steady_clock::time_point epoch_ =
+      std::chrono::steady_clock::now();
+
+  /// Defensive mixture: the current fraction, the candidates of the
+  /// adaptive choice, and the second moments of every candidate per chunk
+  /// and since the last refinement
+  double mix_;
+  static constexpr std::size_t n_mix = 7;
+  static constexpr std::array<double, n_mix> mix_fractions = {
+      1. / 128., 1. / 64., 1. / 32., 1. / 16., 1. / 8., 1. / 4., 1. / 2.};
+  std::vector<double> chunk_mix_;
+  std::array<double, n_mix> pending_mix_{};
+
+  /// randomisations of the quasi-Monte Carlo points per iteration (0:
+  /// pseudo-random points), and the direction numbers or generating vector
+  std::size_t n_random_;
+  SobolSequence sobol_;
+  LatticeRule lattice_;
+
+  /// Stratification: strata per dimension, hypercubes (`n_strata_^Dim`)
+  /// and the stride of every dimension in the hypercube index
+  std::size_t n_strata_ = 1;
+  std::size_t n_cubes_ = 1;
+  std::array<std::size_t, Dim> stride_{};
+  /// allocation weight and variance since the last refinement per
+  /// hypercube
+  std::vector<double> strata_weight_;
+  std::vector<double> strata_var_;
+  /// first point of every hypercube in the current iteration, and the
+  /// weight factor n_samples / (n_cubes * n_h) of its points
+  std::vector<std::uint64_t> cube_start_;
+  std::vector<Float> cube_weight_;
+  /// first hypercube of every chunk, offsets of the chunks' partial sums
+  /// in `cube_partials_` (which hold the sums per chunk and randomisation
+  /// with quasi-Monte Carlo points), and the merged sums per hypercube
+  std::vector<std::size_t> chunk_cube_;
+  std::vector<std::size_t> chunk_partial_;
+  std::vector<Sums> cube_partials_;
+  std::vector<Sums> cube_sums_;
+  Result result_;
+};
+
+}  // namespace kakuhen
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "kakuhen/accumulator.hpp"
+#include "kakuhen/batch.hpp"
+#include "kakuhen/checkpoint.hpp"
+#include "kakuhen/control.hpp"
+#include "kakuhen/event.hpp"
+#include "kakuhen/grid.hpp"
+#include "kakuhen/grid_file.hpp"
+#include "kakuhen/histogram.hpp"
+#include "kakuhen/integrator.hpp"
+#include "kakuhen/lattice.hpp"
+#include "kakuhen/multichannel.hpp"
+#include "kakuhen/options.hpp"
+#include "kakuhen/pairs.hpp"
+#include "kakuhen/philox.hpp"
+#include "kakuhen/profile.hpp"
+#include "kakuhen/result.hpp"
+#include "kakuhen/rng.hpp"
+#include "kakuhen/scheduler.hpp"
+#include "kakuhen/simd.hpp"
+#include "kakuhen/sketch.hpp"
+#include "kakuhen/snapshot.hpp"
+#include "kakuhen/sobol.hpp"
+#include "kakuhen/thread_pool.hpp"
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "kakuhen/rng.hpp"
+
+namespace kakuhen {
+
+/// Generating vector z of an extensible rank-1 lattice in base 2: point k
+/// is frac(phi(k) z), with phi the base-2 radical inverse, so that the
+/// first 2^m points form the lattice {frac(j z / 2^m)} for every m.  The
+/// vector is built once per dimension, component by component: z_d is the
+/// candidate (odd, below 2^search_bits; `candidates` of them drawn by a
+/// fixed hash) that minimises the sum over the embedded lattices of
+/// 2^min_bits to 2^search_bits points of their squared worst-case errors,
+/// each scaled by its number of points squared, in the weighted Korobov
+/// space of smoothness 1 with the product weights 1 / (d + 1).  Then one
+/// bit of every component is added per doubling of the points up to
+/// 2^max_bits, each minimising the error of the lattice of that size.
+class LatticeRule {
+ public:
+  static constexpr unsigned min_bits = 4;
+  static constexpr unsigned search_bits = 14;
+  static constexpr unsigned max_bits = 18;
+  static constexpr std::size_t candidates = 256;
+
+  LatticeRule() = default;
+
+  explicit LatticeRule(std::size_t dim) : z_(dim, 1u) {
+    // component by component over the embedded lattices up to
+    // 2^search_bits points: point j lies in the lattices of 2^m points
+    // with m >= search_bits - (trailing zeros of j)
+    const std::uint32_t n = std::uint32_t(1) << search_bits;
+    std::vector<double> prod(n, 1.);
+    std::vector<double> omega_table(n);
+    for (std::uint32_t j = 0; j < n; ++j) {
+      omega_table[j] = omega(j, search_bits);
+    }
+    std::vector<unsigned> zeros(n, search_bits);
+    for (std::uint32_t j = 1; j < n; ++j) zeros[j] = lowest_bit(j);
+    for (std::size_t d = 0; d < dim; ++d) {
+      const double gamma = 1. / double(d + 1);
+      if (d > 0) {
+        double best = 0.;
+        for (std::size_t i = 0; i < candidates; ++i) {
+          const std::uint32_t c =
+              2 * candidates >= n
+                  ? std::uint32_t(2 * i + 1)
+                  : (std::uint32_t(mix64(std::uint64_t(d) << 32 | i)) &
+                     (n - 1)) | 1u;
+          if (c >= n) break;
+          double level[search_bits + 1] = {};
+          for (std::uint32_t j = 0; j < n; ++j) {
+            level[zeros[j]] += prod[j] * omega_table[(j * c) & (n - 1)];
+          }
+          // lattice of 2^m points: the levels search_bits - m and above,
+          // scaled by (2^m)^2 / 2^m
+          double sum = 0.;
+          for (unsigned t = search_bits - min_bits; t <= search_bits; ++t) {
+            sum += level[t];
+          }
+          double e = double(std::uint64_t(1) << min_bits) * sum;
+          for (unsigned m = min_bits + 1; m <= search_bits; ++m) {
+            sum += level[search_bits - m];
+            e += double(std::uint64_t(1) << m) * sum;
+          }
+          if (i == 0 || e < best) {
+            best = e;
+            z_[d] = c;
+          }
+        }
+      }
+      for (std::uint32_t j = 0; j < n; ++j) {
+        prod[j] *= 1. + gamma * omega_table[(j * z_[d]) & (n - 1)];
+      }
+    }
+    // one more bit of every component per doubling of the points
+    for (unsigned m = search_bits; m < max_bits; ++m) {
+      prod.assign(std::size_t(1) << (m + 1), 1.);
+      for (std::size_t d = 0; d < dim; ++d) {
+        const double gamma = 1. / double(d + 1);
+        if (d > 0) {
+          const std::uint32_t c = z_[d] | (std::uint32_t(1) << m);
+          if (error(prod, c, m + 1) < error(prod, z_[d], m + 1)) z_[d] = c;
+        }
+        for (std::size_t j = 0; j < prod.size(); ++j) {
+          prod[j] *= 1. + gamma * omega(j * z_[d], m + 1);
+        }
+      }
+    }
+  }
+
+  std::size_t dimension() const noexcept { return z_.size(); }
+  const std::uint32_t* generator() const noexcept { return z_.data(); }
+
+ private:
+  /// 2 pi^2 B_2(frac(i / 2^m)), the kernel of the Korobov space
+  static double omega(std::uint64_t i, unsigned m) noexcept {
+    const std::uint64_t mask = (std::uint64_t(1) << m) - 1;
+    const double x = double(i & mask) / double(mask + 1);
+    return 19.739208802178716 * (x * x - x + 1. / 6.);
+  }
+
+  /// squared worst-case error, up to constant terms and factors, of the
+  /// lattice of 2^m points with the components so far (`prod`) and `z`
+  /// next
+  static double error(const std::vector<double>& prod, std::uint32_t z,
+                      unsigned m) noexcept {
+    double s = 0.;
+    for (std::size_t j = 0; j < prod.size(); ++j) {
+      s += prod[j] * omega(j * z, m);
+    }
+    return s;
+  }
+
+  static unsigned lowest_bit(std::uint32_t k) noexcept {
+    unsigned b = 0;
+    while (!((k >> b) & 1u)) ++b;
+    return b;
+  }
+
+  std::vector<std::uint32_t> z_;
+};
+
+/// Randomly shifted lattice points of one chunk of an iteration,
+/// interleaved from `n_random` randomisations like those of `SobolStream`.
+/// Coordinate d of point k of a randomisation is phi(k) z_d + Delta_d
+/// modulo 1, computed in 32-bit fixed point as one multiply-add of the
+/// reversed bits of k; the shift Delta, uniform on the 2^-32 grid and drawn
+/// from (seed, iteration, randomisation, dimension), makes every point
+/// uniform, so that each randomisation gives an unbiased estimate.  The
+/// tent (baker's) transform 1 - |2 y - 1| of every coordinate, which keeps
+/// it uniform, lifts the error for smooth non-periodic integrands from
+/// about O(n^-1) to about O(n^-2), up to logarithmic factors; smooth
+/// periodic integrands can still converge faster.
+class LatticeStream {
+ public:
+  LatticeStream() = default;
+
+  LatticeStream(std::size_t dim, std::size_t n_random)
+      : dim_(dim),
+        n_random_(n_random),
+        shift_(dim * n_random),
+        index_(n_random) {}
+
+  /// position the stream at point `first` of iteration `iteration`
+  void reset(const LatticeRule& rule, std::uint64_t seed,
+             std::uint64_t iteration, std::uint64_t first) noexcept {
+    z_ = rule.generator();
+    next_ = std::size_t(first % n_random_);
+    for (std::size_t r = 0; r < n_random_; ++r) {
+      const std::uint64_t ahead = (r + n_random_ - next_) % n_random_;
+      index_[r] = (first + ahead) / n_random_;
+      for (std::size_t d = 0; d < dim_; ++d) {
+        shift_[r * dim_ + d] =
+            std::uint32_t(stream_seed(seed, iteration, r * dim_ + d));
+      }
+    }
+  }
+
+  /// Write the next `n` points to `u[d * stride + i]` (coordinate `d` of
+  /// point `i`) and their randomisations to `group[i]`.
+  template <typename Float>
+  void fill(Float* u, std::size_t stride, std::size_t n,
+            std::uint32_t* group) noexcept {
+    const std::size_t dim = dim_;
+    const std::uint32_t* z = z_;
+    for (std::size_t i = 0; i < n; ++i) {
+      const std::size_t r = next_;
+      const std::uint32_t k = reverse_bits(std::uint32_t(index_[r]++));
+      const std::uint32_t* shift = shift_.data() + r * dim;
+      for (std::size_t d = 0; d < dim; ++d) {
+        const std::uint32_t y = tent(k * z[d] + shift[d]);
+        u[d * stride + i] = Xoshiro256pp::to_uniform<Float>(std::uint64_t(y)
+                                                            << 32);
+      }
+      group[i] = std::uint32_t(r);
+      next_ = r + 1 == n_random_ ? 0 : r + 1;
+    }
+  }
+
+ private:
+  /// baker's transform 1 - |2 y - 1| in 32-bit fixed point
+  static std::uint32_t tent(std::uint32_t y) noexcept {
+    return (y << 1) ^ (0u - (y >> 31));
+  }
+
+  const std::uint32_t* z_ = nullptr;
+  std::size_t dim_ = 0;
+  std::size_t n_random_ = 0;
+  /// shift of every randomisation ([randomisation][dimension]) and the
+  /// index of its next point
+  std::vector<std::uint32_t> shift_;
+  std::vector<std::uint64_t> index_;
+  /// randomisation of the next point
+  std::size_t next_ = 0;
+};
+
+}  // namespace kakuhen
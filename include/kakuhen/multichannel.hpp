@@ -0,0 +1,345 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "kakuhen/integrator.hpp"
+
+namespace kakuhen {
+
+/// Multi-channel integrator for integrands that are sums of differently
+/// peaked terms.
+///
+/// The points are drawn from the mixture g(x) = sum_i alpha_i g_i(x) of
+/// `n` channels.  Channel `i` draws `y` from its own `Integrator` (1D grids
+/// and two-point tables) and maps it to x = phi_i(y) with a user-supplied
+/// mapping that absorbs one of the peaks.  Every point gets the weight
+/// 1 / g(x), which takes the densities of all channels at `x` and thus the
+/// inverse mappings.  The `Mappings` object provides
+///
+///   std::size_t size() const;  // number of channels
+///   // x = phi_i(y); returns |dx/dy|
+///   Float map(std::size_t i, const point_type& y, point_type& x) const;
+///   // y = phi_i^-1(x); returns |dy/dx|, 0 if x is not in the image of phi_i
+///   Float inverse(std::size_t i, const point_type& x, point_type& y) const;
+///
+/// and is called concurrently from the threads.
+///
+/// An iteration allots its points to the channels in proportion to the
+/// channel weights alpha_i, with at least two per channel, so that every
+/// term of the estimate and its variance is measured.  The integral is
+/// estimated as sum_i alpha_i <f / g>_i, and every channel refines its grids
+/// from |f / g| of its own points, which adapts channel `i` to its share
+/// alpha_i g_i / g of the integrand.  The weights are optimised for minimal
+/// variance as in Kleiss and Pittau: alpha_i <- alpha_i W_i^beta with
+/// W_i = int g_i f^2 / g^2 (see `Options::channel_beta` and
+/// `Options::channel_floor`).
+///
+/// All channels run on one thread pool.  The chunks of all channels are
+/// handed out together by work stealing, every chunk draws from its own
+/// random stream and all sums are reduced in a fixed order, so results are
+/// bit-identical for any number of threads.  The channels do not stratify
+/// and draw pseudo-random points (`Options::stratify` and
+/// `Options::sampling` are ignored).  With `KAKUHEN_PROFILE` every channel
+/// keeps the stage times of its own points (`channel(i).profile()`), the
+/// mappings and channel densities counted as `Stage::grid`.
+template <std::size_t Dim, typename Mappings, typename Float = double>
+class MultiChannel {
+ public:
+  using integrator_type = Integrator<Dim, Float>;
+  using float_type = Float;
+  using point_type = typename integrator_type::point_type;
+  using batch_type = typename integrator_type::batch_type;
+
+  static constexpr std::size_t dimension = Dim;
+
+  /// throws `std::invalid_argument` if `mappings` has no channels, or as
+  /// `Integrator` for invalid options
+  explicit MultiChannel(Mappings mappings, const Options& opts = Options{})
+      : maps_(std::move(mappings)),
+        opts_(opts),
+        pool_(std::make_shared<ThreadPool>(opts.n_threads)),
+        scheduler_(pool_->size()) {
+    const std::size_t n = maps_.size();
+    if (n == 0) {
+      throw std::invalid_argument("kakuhen::MultiChannel: no channels");
+    }
+    opts_.batch_size = std::max<std::size_t>(opts_.batch_size, 1);
+    opts_.chunk_size = std::max<std::size_t>(opts_.chunk_size, 1);
+    opts_.stratify = false;
+    opts_.sampling = Sampling::random;
+    channels_.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      channels_.emplace_back(new integrator_type(opts_, pool_));
+    }
+    alpha_.assign(n, 1. / double(n));
+    pending_w_.assign(n, 0.);
+    shares_.assign(pool_->size(), std::vector<Float>(opts_.batch_size * n));
+  }
+
+  const Options& options() const noexcept { return opts_; }
+  const Mappings& mappings() const noexcept { return maps_; }
+  std::size_t n_channels() const noexcept { return channels_.size(); }
+  std::size_t n_threads() const noexcept { return pool_->size(); }
+  /// grids and tables of channel `i` in the space of its `y`
+  const integrator_type& channel(std::size_t i) const noexcept {
+    return *channels_[i];
+  }
+  /// current weight of channel `i`
+  double alpha(std::size_t i) const noexcept { return alpha_[i]; }
+
+  /// Run a single iteration of `n_samples` points over all channels; the
+  /// integrand is called as `f(x)`.  With `adapt` the channel grids and the
+  /// channel weights are refined afterwards.
+  template <typename F>
+  Estimate iterate(F&& f, std::uint64_t n_samples, bool adapt = true) {
+    return iterate_batch(
+        [&f](const batch_type& batch, Float* values) {
+          for (std::size_t i = 0; i < batch.size(); ++i) {
+            values[i] = Float(f(batch.point(i)));
+          }
+        },
+        n_samples, adapt);
+  }
+
+  /// Same as `iterate` for an integrand called as `f(batch, values)` (see
+  /// `Integrator::iterate_batch`).  The batch holds the mapped points `x`
+  /// with the weights 1 / g(x); its bins are those of the channel's `y`.
+  /// Throws `std::invalid_argument` if `n_samples` is less than two points
+  /// per channel: a channel without points would drop its term
+  /// alpha_i <f / g>_i from the estimate.
+  template <typename F>
+  Estimate iterate_batch(F&& f, std::uint64_t n_samples, bool adapt = true) {
+    const std::size_t n = channels_.size();
+    if (n_samples < 2 * std::uint64_t(n)) {
+      throw std::invalid_argument(
+          "kakuhen::MultiChannel::iterate: fewer than two points per "
+          "channel");
+    }
+    allocate(n_samples);
+    const std::size_t n_chunks = chunk_start_.back();
+    if (!calibrated_) calibrate(f);
+
+    chunk_sums_.assign(n_chunks, Sums{});
+    chunk_w_.assign(n_chunks * n, 0.);
+    scheduler_.reset(std::uint32_t(n_chunks), 1);
+    pool_->run([&](std::size_t w) {
+      std::uint32_t begin, end;
+      while (scheduler_.next(w, begin, end)) {
+        for (std::size_t k = begin; k < end; ++k) {
+          chunk_sums_[k] = run_chunk(f, w, k, true);
+        }
+      }
+    });
+
+    // fixed-order reduction per channel; every channel samples its own
+    // density g_i, so its averages enter with the weight alpha_i
+    Estimate est;
+    est.n_samples = n_samples;
+    double var = 0.;
+    for (std::size_t i = 0; i < n; ++i) {
+      Sums sums;
+      for (std::size_t k = chunk_start_[i]; k < chunk_start_[i + 1]; ++k) {
+        sums += chunk_sums_[k];
+      }
+      channels_[i]->pending_ += sums;
+      const Estimate e = sums.estimate();
+      est.value += alpha_[i] * e.value;
+      var += alpha_[i] * alpha_[i] * e.error * e.error;
+      for (std::size_t j = 0; j < n; ++j) {
+        double t = 0.;
+        for (std::size_t k = chunk_start_[i]; k < chunk_start_[i + 1]; ++k) {
+          t += chunk_w_[k * n + j];
+        }
+        pending_w_[j] += alpha_[i] * t / double(sums.n);
+      }
+    }
+    est.error = std::sqrt(var);
+    ++iteration_;
+
+    result_.add(est);
+    if (adapt) this->adapt();
+    for (std::size_t i = 0; i < n; ++i) {
+      channels_[i]->end_profile(iteration_ - 1, points_[i]);
+    }
+    return est;
+  }
+
+  /// `n_iter` calls to `iterate`; returns the combined result
+  template <typename F>
+  const Result& integrate(F&& f, std::size_t n_iter, std::uint64_t n_samples,
+                          bool adapt = true) {
+    for (std::size_t it = 0; it < n_iter; ++it) iterate(f, n_samples, adapt);
+    return result_;
+  }
+
+  /// `n_iter` calls to `iterate_batch`; returns the combined result
+  template <typename F>
+  const Result& integrate_batch(F&& f, std::size_t n_iter,
+                                std::uint64_t n_samples, bool adapt = true) {
+    for (std::size_t it = 0; it < n_iter; ++it) {
+      iterate_batch(f, n_samples, adapt);
+    }
+    return result_;
+  }
+
+  /// combination of all iterations since construction or `clear_result`
+  const Result& result() const noexcept { return result_; }
+  void clear_result() noexcept { result_.clear(); }
+
+  /// Refine the grids and tables of every channel and the channel weights
+  /// from the data accumulated since the last refinement.
+  void adapt() {
+    for (auto& ch : channels_) ch->adapt();
+    const std::size_t n = channels_.size();
+    std::vector<double> alpha(n);
+    double total = 0.;
+    for (std::size_t j = 0; j < n; ++j) {
+      alpha[j] = alpha_[j] * std::pow(pending_w_[j], opts_.channel_beta);
+      if (!(alpha[j] > 0.) || !std::isfinite(alpha[j])) alpha[j] = 0.;
+      total += alpha[j];
+    }
+    std::fill(pending_w_.begin(), pending_w_.end(), 0.);
+    if (!(total > 0.)) return;
+    const double floor = opts_.channel_floor;
+    for (std::size_t j = 0; j < n; ++j) {
+      alpha_[j] = (1. - floor) * alpha[j] / total + floor / double(n);
+    }
+  }
+
+ private:
+  /// Split `n_samples` (at least two per channel) over the channels: two
+  /// points each plus the rest in proportion to the weights, by cumulative
+  /// rounding; number the chunks of all channels consecutively.
+  void allocate(std::uint64_t n_samples) {
+    const std::size_t n = channels_.size();
+    const std::uint64_t least = 2;
+    const double spare = double(n_samples - least * n);
+    const std::uint64_t chunk = opts_.chunk_size;
+    points_.resize(n);
+    chunk_start_.assign(n + 1, 0);
+    double c = 0.;
+    std::uint64_t done = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      c += double(least) + spare * alpha_[i];
+      // rounding errors must not take the least share of any channel
+      const std::uint64_t last = n_samples - least * (n - 1 - i);
+      const std::uint64_t upto =
+          i + 1 < n ? std::min(std::uint64_t(std::floor(c + 0.5)), last)
+                    : n_samples;
+      points_[i] = std::max(upto, done + least) - done;
+      done += points_[i];
+      chunk_start_[i + 1] =
+          chunk_start_[i] + std::size_t((points_[i] + chunk - 1) / chunk);
+    }
+  }
+
+  /// Fix the histogram unit of all channels from a pilot run of the first
+  /// chunk, which is evaluated again as part of the iteration.
+  template <typename F>
+  void calibrate(F& f) {
+    const Sums sums = run_chunk(f, 0, 0, false);
+    for (auto& ch : channels_) ch->set_unit(sums);
+    calibrated_ = true;
+  }
+
+  /// Evaluate chunk `k` (numbered across all channels) on worker `w`;
+  /// `fill` selects whether the refinement data is accumulated.
+  template <typename F>
+  Sums run_chunk(F& f, std::size_t w, std::size_t k, bool fill) {
+    const std::size_t n_ch = channels_.size();
+    const std::size_t i = std::size_t(
+        std::upper_bound(chunk_start_.begin(), chunk_start_.end(), k) -
+        chunk_start_.begin() - 1);
+    integrator_type& ch = *channels_[i];
+    auto& wk = ch.workers_[w];
+    const std::uint64_t chunk = opts_.chunk_size;
+    const std::uint64_t first = std::uint64_t(k - chunk_start_[i]) * chunk;
+    const std::uint64_t n = std::min(chunk, points_[i] - first);
+    TraceSpan span(wk.profile);
+    wk.rng.reset(opts_.seed, (iteration_ << 32) | std::uint64_t(k));
+
+    // g_j(x) / g(x) of every point and channel
+    Float* share = shares_[w].data();
+    double* wsum = chunk_w_.data() + k * n_ch;
+    Sums sums;
+    const std::size_t cap = wk.batch.capacity();
+    for (std::uint64_t done = 0; done < n;) {
+      const std::size_t m = std::size_t(std::min<std::uint64_t>(cap, n - done));
+      ch.sample_block(wk, m);
+      Stopwatch watch(wk.profile);
+      batch_type& batch = wk.batch;
+      Float* wt = batch.weight();
+      for (std::size_t p = 0; p < m; ++p) {
+        const point_type y = batch.point(p);
+        point_type x, yj;
+        const Float jac = maps_.map(i, y, x);
+        Float* gp = share + p * n_ch;
+        Float g = Float(0);
+        for (std::size_t j = 0; j < n_ch; ++j) {
+          if (j == i) {
+            gp[j] = Float(1) / (wt[p] * jac);
+          } else {
+            const Float inv = maps_.inverse(j, x, yj);
+            gp[j] = inv > Float(0) ? channels_[j]->density(yj) * inv : Float(0);
+          }
+          g += Float(alpha_[j]) * gp[j];
+        }
+        for (std::size_t d = 0; d < Dim; ++d) batch.x(d)[p] = x[d];
+        if (g > Float(0) && std::isfinite(g)) {
+          wt[p] = Float(1) / g;
+          for (std::size_t j = 0; j < n_ch; ++j) gp[j] *= wt[p];
+        } else {
+          wt[p] = Float(0);
+          std::fill_n(gp, n_ch, Float(0));
+        }
+      }
+      watch.lap(Stage::grid);
+      f(static_cast<const batch_type&>(batch), wk.values.data());
+      watch.lap(Stage::integrand);
+      ch.accumulate_block(wk, sums, fill);
+      if (fill) {
+        for (std::size_t p = 0; p < m; ++p) {
+          const double fw = double(wk.values[p]) * double(wt[p]);
+          for (std::size_t j = 0; j < n_ch; ++j) {
+            wsum[j] += double(share[p * n_ch + j]) * fw * fw;
+          }
+        }
+      }
+      watch.lap(Stage::accumulation);
+      done += m;
+    }
+    span.close("chunk", w, ch.epoch_);
+    return sums;
+  }
+
+  Mappings maps_;
+  Options opts_;
+  std::shared_ptr<ThreadPool> pool_;
+  WorkStealingScheduler scheduler_;
+  std::vector<std::unique_ptr<integrator_type>> channels_;
+  /// channel weights, and the variance measures W_i accumulated since the
+  /// last refinement
+  std::vector<double> alpha_;
+  std::vector<double> pending_w_;
+  /// points per channel in the current iteration and the first chunk of
+  /// every channel (`chunk_start_[n]`: number of chunks)
+  std::vector<std::uint64_t> points_;
+  std::vector<std::size_t> chunk_start_;
+  /// per chunk: sums of f / g and the contributions to W_j
+  std::vector<Sums> chunk_sums_;
+  std::vector<double> chunk_w_;
+  /// per worker: g_j / g of the points of the current block
+  std::vector<std::vector<Float>> shares_;
+  bool calibrated_ = false;
+  std::uint64_t iteration_ = 0;
+  Result result_;
+};
+
+}  // namespace kakuhen
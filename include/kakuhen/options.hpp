@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kakuhen {
+
+/// Which pairs of dimensions are sampled from two-point tables.  Each
+/// dimension is conditional on at most one other one (its parent), so that
+/// the cost of sampling and refinement grows linearly with the dimension.
+/// Full pairwise conditioning, every dimension on all the others, is not
+/// offered: a one-parent table cannot represent it, and its D (D - 1) / 2
+/// histograms would not scale to 30 dimensions.
+enum class Structure {
+  /// every dimension `d > 0` conditional on dimension `d - 1`
+  chain,
+  /// the pairs listed in `Options::pairs`, which must not form a cycle
+  pairs,
+  /// Chow-Liu tree: the spanning tree of maximal mutual information of the
+  /// two-point histograms, learned from all pairs (see
+  /// `Options::tree_updates`)
+  tree,
+  /// no pairs: every dimension is sampled from its 1D grid alone, i.e.
+  /// plain VEGAS, without any of the cost of the two-point tables
+  none,
+};
+
+/// Safe density of the defensive mixture (see `Options::defensive`).
+enum class Defensive {
+  /// uniform on the unit hypercube: bounds the weights by 1 / defensive
+  uniform,
+  /// the 1D grids without the two-point tables (the VEGAS density):
+  /// bounds the weights by the factorised density, which covers the
+  /// marginals
+  factorized,
+};
+
+/// How the points of a block are added to the histograms of the two-point
+/// tables (the results are the same either way).
+enum class Accumulation {
+  /// `sort` if the histogram block of one pair exceeds
+  /// `Options::cache_size`, otherwise `scatter`
+  automatic,
+  /// add every point to its cell directly, one pair after the other, so
+  /// that only the block of one pair is written at a time
+  scatter,
+  /// sort-then-reduce: radix sort the (cell, count) pairs of the block by
+  /// cell, pair by pair, and add every run of equal cells at once, walking
+  /// the histograms in address order
+  sort,
+};
+
+/// Source of the uniform numbers that the grids and tables map into points.
+enum class Sampling {
+  /// pseudo-random numbers of the chunk's Philox stream
+  random,
+  /// randomised quasi-Monte Carlo: scrambled Sobol points (see
+  /// `SobolStream`), which fill the unit hypercube more evenly and make
+  /// the error of smooth integrands fall faster than 1 / sqrt(n)
+  sobol,
+  /// randomised quasi-Monte Carlo: randomly shifted points of an
+  /// extensible rank-1 lattice (see `LatticeStream`), one multiply-add per
+  /// coordinate; as good as Sobol points with `Structure::none`, worse
+  /// with the two-point tables, whose piecewise map spoils the lattice
+  lattice,
+};
+
+/// Run-time settings of the `Integrator`.
+struct Options {
+  /// number of bins per dimension (1D grids and both axes of the pair tables)
+  std::size_t n_bins = 64;
+  /// VEGAS damping exponent for the 1D grid refinement
+  double alpha = 1.5;
+  /// fraction of the newly measured conditional bin probabilities that is
+  /// mixed into the two-point tables at each refinement
+  double pair_damping = 0.5;
+  /// every conditional bin keeps at least `pair_floor / n_bins` probability
+  double pair_floor = 0.1;
+  /// dependency structure of the two-point tables
+  Structure structure = Structure::chain;
+  /// pairs of dimensions for `Structure::pairs`
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> pairs;
+  /// number of refinements for which `Structure::tree` accumulates the
+  /// histograms of all D (D - 1) / 2 pairs and re-learns the tree; after
+  /// that the tree is kept fixed (0: re-learn at every refinement)
+  std::size_t tree_updates = 1;
+  /// number of points generated and evaluated per block
+  std::size_t batch_size = 256;
+  /// number of points per chunk, the unit of work distributed over threads
+  /// that draws from its own random stream; results depend on it but not
+  /// on the number of threads
+  std::size_t chunk_size = 1024;
+  /// size of the thread pool including the calling thread (0: one per core)
+  std::size_t n_threads = 1;
+  /// target duration in seconds of a scheduler task; the number of chunks
+  /// per task is tuned from the measured cost per point (scheduling only,
+  /// results do not depend on it)
+  double task_time = 2e-4;
+  /// keep the per-thread histograms of the two-point tables sparse (only
+  /// the cells filled in an iteration) instead of dense; pays off when
+  /// the points per thread and iteration are few compared to the cells
+  bool sparse_pairs = false;
+  /// accumulation of the pair histograms
+  Accumulation accumulation = Accumulation::automatic;
+  /// cache in bytes that `Accumulation::automatic` compares the histogram
+  /// block of one pair (n_bins^2 counts) to.  The pair-by-pair scatter
+  /// keeps up with sort-then-reduce far beyond the per-core caches on
+  /// out-of-order CPUs, hence the default of the order of a last-level
+  /// cache.
+  std::size_t cache_size = std::size_t(64) << 20;
+  /// Defensive mixture: the fraction of the points drawn from the safe
+  /// density `defensive_density` instead of the grids and tables; every
+  /// point is weighted with the inverse of the mixture density, so that
+  /// regions the adapted density under-covers cannot produce unbounded
+  /// weights (0: off; not combined with `stratify`)
+  double defensive = 0.;
+  Defensive defensive_density = Defensive::uniform;
+  /// choose the fraction at every refinement among 1/128, 1/64, ..., 1/2
+  /// as the one of least variance estimated from the points since the last
+  /// refinement (starting from `defensive`)
+  bool defensive_adapt = false;
+  /// record the weights |f w| in a quantile sketch (`WeightSketch`, see
+  /// `Integrator::weight_quantile`) from the first iteration on; costs a
+  /// few nanoseconds per point.  Otherwise the recording starts with the
+  /// first call to `Integrator::weight_quantile` or `Integrator::unweight`.
+  bool weight_sketch = false;
+  /// Adaptive stratification (VEGAS+): the unit hypercube of the uniform
+  /// numbers that the grids and tables map into points is divided into
+  /// equal hypercubes, and the points of an iteration are allotted to them
+  /// in proportion to (sigma_h^2)^(strata_beta / 2), with sigma_h^2 the
+  /// variance contributed by hypercube `h` as measured since the last
+  /// refinement, and at least two per hypercube.
+  bool stratify = false;
+  /// damping of the allocation: 0 samples all hypercubes equally, 1 in
+  /// proportion to their standard deviation
+  double strata_beta = 0.75;
+  /// upper limit on the number of hypercubes; there are at most half as
+  /// many as points per iteration
+  std::size_t max_strata = 65536;
+  /// Source of the uniform numbers.  `Sampling::sobol` and
+  /// `Sampling::lattice` interleave the points of every iteration from
+  /// `randomizations` independent randomisations of the point set; the
+  /// estimates of the randomisations are unbiased, and the error of the
+  /// iteration is taken from their spread (at least two, and two points
+  /// each per iteration; not combined with `stratify`, whose strata the
+  /// quasi-Monte Carlo points already balance).
+  Sampling sampling = Sampling::random;
+  std::size_t randomizations = 16;
+  /// `MultiChannel`: exponent of the update of the channel weights,
+  /// alpha_i <- alpha_i * W_i^channel_beta with W_i the variance measure of
+  /// channel `i` (0 keeps the weights fixed)
+  double channel_beta = 0.5;
+  /// `MultiChannel`: every channel keeps at least `channel_floor / n` of
+  /// the weight, with `n` the number of channels
+  double channel_floor = 0.01;
+  std::uint64_t seed = 0;
+  /// Write a `Checkpoint` of the integrator to this file (atomically) every
+  /// `checkpoint_interval` seconds while it iterates, from a background
+  /// thread (empty: never; iterations that fill `Histograms` are not
+  /// checkpointed within, as the histograms are not part of the state)
+  std::string checkpoint_path;
+  double checkpoint_interval = 600.;
+};
+
+}  // namespace kakuhen
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace kakuhen {
+
+/// Packed layout of the two-point tables.
+///
+/// A pair `(i, j)` of dimensions, `i < j`, owns one contiguous block of
+/// `n_bins * n_bins` cells `[bin of i][bin of j]`.  Only the pairs in use
+/// are stored: their blocks follow each other in upper-triangular order
+/// (by `i`, then `j`), so tables, alias tables and histograms of all pairs are
+/// single dense arrays, and `slot` finds the block of a pair through its
+/// packed upper-triangular index without a D x D lookup matrix of blocks.
+class PairLayout {
+ public:
+  using pair_type = std::pair<std::uint32_t, std::uint32_t>;
+
+  static constexpr std::size_t npos = ~std::size_t(0);
+
+  PairLayout() = default;
+
+  /// layout of the given pairs; throws `std::invalid_argument` unless every
+  /// pair satisfies `first < second < n_dims`
+  PairLayout(std::size_t n_dims, std::size_t n_bins,
+             std::vector<pair_type> pairs)
+      : n_dims_(n_dims), n_bins_(n_bins), pairs_(std::move(pairs)) {
+    for (const pair_type& pr : pairs_) {
+      if (!(pr.first < pr.second && pr.second < n_dims_)) {
+        throw std::invalid_argument("kakuhen::PairLayout: invalid pair");
+      }
+    }
+    std::sort(pairs_.begin(), pairs_.end());
+    pairs_.erase(std::unique(pairs_.begin(), pairs_.end()), pairs_.end());
+    if (std::uint64_t(pairs_.size()) * block_size() >= ~std::uint32_t(0)) {
+      throw std::invalid_argument("kakuhen::PairLayout: too many cells");
+    }
+    slots_.assign(n_dims_ * (n_dims_ - 1) / 2, npos);
+    for (std::size_t p = 0; p < pairs_.size(); ++p) {
+      slots_[triangular(pairs_[p].first, pairs_[p].second)] = p;
+    }
+  }
+
+  /// the pairs `(d, d + 1)` of neighbouring dimensions
+  static PairLayout chain(std::size_t n_dims, std::size_t n_bins) {
+    std::vector<pair_type> pairs;
+    for (std::size_t d = 1; d < n_dims; ++d) {
+      pairs.emplace_back(std::uint32_t(d - 1), std::uint32_t(d));
+    }
+    return PairLayout(n_dims, n_bins, std::move(pairs));
+  }
+
+  std::size_t n_dims() const noexcept { return n_dims_; }
+  std::size_t n_bins() const noexcept { return n_bins_; }
+  /// number of stored pairs
+  std::size_t size() const noexcept { return pairs_.size(); }
+  std::size_t block_size() const noexcept { return n_bins_ * n_bins_; }
+  std::size_t n_cells() const noexcept { return size() * block_size(); }
+
+  const pair_type& pair(std::size_t p) const noexcept { return pairs_[p]; }
+  std::size_t first(std::size_t p) const noexcept { return pairs_[p].first; }
+  std::size_t second(std::size_t p) const noexcept { return pairs_[p].second; }
+  /// first cell of the block of pair `p`
+  std::size_t offset(std::size_t p) const noexcept { return p * block_size(); }
+
+  /// index of the pair `(i, j)`, `i < j`, or `npos` if it is not stored
+  std::size_t slot(std::size_t i, std::size_t j) const noexcept {
+    return slots_[triangular(i, j)];
+  }
+
+ private:
+  /// position of `(i, j)`, `i < j`, in the row-major upper triangle
+  std::size_t triangular(std::size_t i, std::size_t j) const noexcept {
+    return i * (2 * n_dims_ - i - 1) / 2 + (j - i - 1);
+  }
+
+  std::size_t n_dims_ = 0;
+  std::size_t n_bins_ = 0;
+  std::vector<pair_type> pairs_;
+  std::vector<std::size_t> slots_;
+};
+
+}  // namespace kakuhen
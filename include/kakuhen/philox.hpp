@@ -0,0 +1,388 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "kakuhen/simd.hpp"
+
+namespace kakuhen {
+
+/// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as
+/// 1, 2, 3"): a keyed bijection of 128-bit counters.
+struct Philox4x32 {
+  using counter_type = std::array<std::uint32_t, 4>;
+  using key_type = std::array<std::uint32_t, 2>;
+
+  static constexpr std::uint32_t M0 = 0xD2511F53u;
+  static constexpr std::uint32_t M1 = 0xCD9E8D57u;
+  static constexpr std::uint32_t W0 = 0x9E3779B9u;
+  static constexpr std::uint32_t W1 = 0xBB67AE85u;
+  static constexpr int rounds = 10;
+
+  static constexpr counter_type apply(counter_type c, key_type k) noexcept {
+    for (int r = 0; r < rounds; ++r) {
+      const std::uint64_t p0 = std::uint64_t(M0) * c[0];
+      const std::uint64_t p1 = std::uint64_t(M1) * c[2];
+      c = {std::uint32_t(p1 >> 32) ^ c[1] ^ k[0], std::uint32_t(p1),
+           std::uint32_t(p0 >> 32) ^ c[3] ^ k[1], std::uint32_t(p0)};
+      k[0] += W0;
+      k[1] += W1;
+    }
+    return c;
+  }
+};
+
+namespace philox {
+
+/// counters per group: the unit in which `PhiloxStream::fill_uniform`
+/// consumes the stream
+constexpr std::size_t group = 8;
+
+/// uniform double in [0, 1) from the top 52 bits of `r`
+inline double to_double(std::uint64_t r) noexcept {
+  const std::uint64_t bits = (r >> 12) | 0x3FF0000000000000ULL;
+  double d;
+  std::memcpy(&d, &bits, sizeof d);
+  return d - 1.;
+}
+
+/// uniform float in [0, 1) from the top 23 bits of `r`
+inline float to_float(std::uint32_t r) noexcept {
+  const std::uint32_t bits = (r >> 9) | 0x3F800000u;
+  float f;
+  std::memcpy(&f, &bits, sizeof f);
+  return f - 1.f;
+}
+
+/// uniform numbers produced per group of counters
+template <typename Float>
+constexpr std::size_t per_group =
+    group * (sizeof(Float) <= sizeof(float) ? 4 : 2);
+
+/// Uniform numbers of `n_groups` groups of counters starting at `pos`.
+/// Within a group, doubles are written word-pair major (the low pairs of
+/// all counters, then the high pairs) and floats word major; all
+/// instruction-set levels produce the same layout.
+template <typename Float>
+void scalar_groups(Philox4x32::key_type key, std::uint64_t stream,
+                   std::uint64_t pos, std::size_t n_groups,
+                   Float* out) noexcept {
+  for (std::size_t g = 0; g < n_groups; ++g, out += per_group<Float>) {
+    for (std::size_t j = 0; j < group; ++j) {
+      const std::uint64_t p = pos + g * group + j;
+      const auto c = Philox4x32::apply(
+          {std::uint32_t(p), std::uint32_t(p >> 32), std::uint32_t(stream),
+           std::uint32_t(stream >> 32)},
+          key);
+      if constexpr (sizeof(Float) <= sizeof(float)) {
+        for (std::size_t k = 0; k < 4; ++k) {
+          out[k * group + j] = to_float(c[k]);
+        }
+      } else {
+        out[j] = Float(to_double((std::uint64_t(c[1]) << 32) | c[0]));
+        out[group + j] = Float(to_double((std::uint64_t(c[3]) << 32) | c[2]));
+      }
+    }
+  }
+}
+
+#ifdef KAKUHEN_SIMD_X86
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+
+/// round keys, broadcast per round by the vector kernels
+struct RoundKeys {
+  explicit RoundKeys(Philox4x32::key_type key) noexcept {
+    for (int r = 0; r < Philox4x32::rounds; ++r) {
+      k0[r] = key[0];
+      k1[r] = key[1];
+      key[0] += Philox4x32::W0;
+      key[1] += Philox4x32::W1;
+    }
+  }
+  std::uint32_t k0[Philox4x32::rounds];
+  std::uint32_t k1[Philox4x32::rounds];
+};
+
+/// groups in flight per iteration of the vector kernels: the rounds form a
+/// chain of dependent multiplications, interleaving independent counters
+/// hides their latency
+constexpr std::size_t interleave = 4;
+
+/// Philox rounds on `U` sets of four vectors of counter words held in the
+/// low halves of 64-bit lanes; the words are replaced by the output.
+template <std::size_t U>
+__attribute__((target("avx2"))) inline void rounds_avx2(
+    const RoundKeys& rk, __m256i (&w)[U][4]) noexcept {
+  const __m256i m0 = _mm256_set1_epi64x(Philox4x32::M0);
+  const __m256i m1 = _mm256_set1_epi64x(Philox4x32::M1);
+  const __m256i lo = _mm256_set1_epi64x(0xFFFFFFFFLL);
+  for (int r = 0; r < Philox4x32::rounds; ++r) {
+    const __m256i k0 = _mm256_set1_epi64x(rk.k0[r]);
+    const __m256i k1 = _mm256_set1_epi64x(rk.k1[r]);
+    for (std::size_t u = 0; u < U; ++u) {
+      const __m256i p0 = _mm256_mul_epu32(w[u][0], m0);
+      const __m256i p1 = _mm256_mul_epu32(w[u][2], m1);
+      w[u][0] = _mm256_xor_si256(
+          _mm256_xor_si256(_mm256_srli_epi64(p1, 32), w[u][1]), k0);
+      w[u][2] = _mm256_xor_si256(
+          _mm256_xor_si256(_mm256_srli_epi64(p0, 32), w[u][3]), k1);
+      w[u][1] = _mm256_and_si256(p1, lo);
+      w[u][3] = _mm256_and_si256(p0, lo);
+    }
+  }
+}
+
+/// Uniform numbers of the `U` groups of counters starting at `pos`; each
+/// group takes two sets of words of four counters each.
+template <std::size_t U, typename Float>
+__attribute__((target("avx2"))) inline void block_avx2(
+    const RoundKeys& rk, std::uint64_t stream, std::uint64_t pos,
+    Float* out) noexcept {
+  static_assert(group == 8, "two AVX2 registers of 64-bit lanes per word");
+  const __m256i lo = _mm256_set1_epi64x(0xFFFFFFFFLL);
+  __m256i w[2 * U][4];
+  for (std::size_t u = 0; u < 2 * U; ++u) {
+    const __m256i p =
+        _mm256_add_epi64(_mm256_set1_epi64x(std::int64_t(pos + 4 * u)),
+                         _mm256_setr_epi64x(0, 1, 2, 3));
+    w[u][0] = _mm256_and_si256(p, lo);
+    w[u][1] = _mm256_srli_epi64(p, 32);
+    w[u][2] = _mm256_set1_epi64x(std::int64_t(stream & 0xFFFFFFFFu));
+    w[u][3] = _mm256_set1_epi64x(std::int64_t(stream >> 32));
+  }
+  rounds_avx2(rk, w);
+  for (std::size_t u = 0; u < 2 * U; ++u) {
+    Float* o = out + (u / 2) * per_group<Float> + (u % 2) * 4;
+    if constexpr (sizeof(Float) <= sizeof(float)) {
+      const __m256i perm = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+      for (std::size_t k = 0; k < 4; ++k) {
+        const __m128i c = _mm256_castsi256_si128(
+            _mm256_permutevar8x32_epi32(w[u][k], perm));
+        const __m128i bits =
+            _mm_or_si128(_mm_srli_epi32(c, 9), _mm_set1_epi32(0x3F800000));
+        _mm_storeu_ps(o + k * group,
+                      _mm_sub_ps(_mm_castsi128_ps(bits), _mm_set1_ps(1.f)));
+      }
+    } else {
+      for (std::size_t k = 0; k < 2; ++k) {
+        const __m256i r = _mm256_or_si256(
+            _mm256_slli_epi64(w[u][2 * k + 1], 32), w[u][2 * k]);
+        const __m256i bits =
+            _mm256_or_si256(_mm256_srli_epi64(r, 12),
+                            _mm256_set1_epi64x(0x3FF0000000000000LL));
+        _mm256_storeu_pd(o + k * group, _mm256_sub_pd(_mm256_castsi256_pd(bits),
+                                                      _mm256_set1_pd(1.)));
+      }
+    }
+  }
+}
+
+template <typename Float>
+__attribute__((target("avx2"))) void groups_avx2(
+    Philox4x32::key_type key, std::uint64_t stream, std::uint64_t pos,
+    std::size_t n_groups, Float* out) noexcept {
+  const RoundKeys rk(key);
+  std::size_t g = 0;
+  for (; g + interleave <= n_groups; g += interleave) {
+    block_avx2<interleave>(rk, stream, pos + g * group,
+                           out + g * per_group<Float>);
+  }
+  for (; g < n_groups; ++g) {
+    block_avx2<1>(rk, stream, pos + g * group, out + g * per_group<Float>);
+  }
+}
+
+template <std::size_t U>
+__attribute__((target("avx512f"))) inline void rounds_avx512(
+    const RoundKeys& rk, __m512i (&w)[U][4]) noexcept {
+  const __m512i m0 = _mm512_set1_epi64(Philox4x32::M0);
+  const __m512i m1 = _mm512_set1_epi64(Philox4x32::M1);
+  const __m512i lo = _mm512_set1_epi64(0xFFFFFFFFLL);
+  for (int r = 0; r < Philox4x32::rounds; ++r) {
+    const __m512i k0 = _mm512_set1_epi64(rk.k0[r]);
+    const __m512i k1 = _mm512_set1_epi64(rk.k1[r]);
+    for (std::size_t u = 0; u < U; ++u) {
+      const __m512i p0 = _mm512_mul_epu32(w[u][0], m0);
+      const __m512i p1 = _mm512_mul_epu32(w[u][2], m1);
+      // three-way xor in a single instruction (truth table 0x96)
+      w[u][0] = _mm512_ternarylogic_epi64(_mm512_srli_epi64(p1, 32), w[u][1],
+                                          k0, 0x96);
+      w[u][2] = _mm512_ternarylogic_epi64(_mm512_srli_epi64(p0, 32), w[u][3],
+                                          k1, 0x96);
+      w[u][1] = _mm512_and_si512(p1, lo);
+      w[u][3] = _mm512_and_si512(p0, lo);
+    }
+  }
+}
+
+/// uniform numbers of the `U` groups of counters starting at `pos`
+template <std::size_t U, typename Float>
+__attribute__((target("avx512f"))) inline void block_avx512(
+    const RoundKeys& rk, std::uint64_t stream, std::uint64_t pos,
+    Float* out) noexcept {
+  static_assert(group == 8, "one AVX-512 register of 64-bit lanes per word");
+  const __m512i lo = _mm512_set1_epi64(0xFFFFFFFFLL);
+  __m512i w[U][4];
+  for (std::size_t u = 0; u < U; ++u) {
+    const __m512i p =
+        _mm512_add_epi64(_mm512_set1_epi64(std::int64_t(pos + group * u)),
+                         _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7));
+    w[u][0] = _mm512_and_si512(p, lo);
+    w[u][1] = _mm512_srli_epi64(p, 32);
+    w[u][2] = _mm512_set1_epi64(std::int64_t(stream & 0xFFFFFFFFu));
+    w[u][3] = _mm512_set1_epi64(std::int64_t(stream >> 32));
+  }
+  rounds_avx512(rk, w);
+  for (std::size_t u = 0; u < U; ++u) {
+    Float* o = out + u * per_group<Float>;
+    if constexpr (sizeof(Float) <= sizeof(float)) {
+      for (std::size_t k = 0; k < 4; ++k) {
+        const __m256i bits = _mm256_or_si256(
+            _mm256_srli_epi32(_mm512_cvtepi64_epi32(w[u][k]), 9),
+            _mm256_set1_epi32(0x3F800000));
+        _mm256_storeu_ps(o + k * group, _mm256_sub_ps(_mm256_castsi256_ps(bits),
+                                                      _mm256_set1_ps(1.f)));
+      }
+    } else {
+      for (std::size_t k = 0; k < 2; ++k) {
+        const __m512i r = _mm512_or_si512(
+            _mm512_slli_epi64(w[u][2 * k + 1], 32), w[u][2 * k]);
+        const __m512i bits =
+            _mm512_or_si512(_mm512_srli_epi64(r, 12),
+                            _mm512_set1_epi64(0x3FF0000000000000LL));
+        _mm512_storeu_pd(o + k * group, _mm512_sub_pd(_mm512_castsi512_pd(bits),
+                                                      _mm512_set1_pd(1.)));
+      }
+    }
+  }
+}
+
+template <typename Float>
+__attribute__((target("avx512f"))) void groups_avx512(
+    Philox4x32::key_type key, std::uint64_t stream, std::uint64_t pos,
+    std::size_t n_groups, Float* out) noexcept {
+  const RoundKeys rk(key);
+  std::size_t g = 0;
+  for (; g + interleave <= n_groups; g += interleave) {
+    block_avx512<interleave>(rk, stream, pos + g * group,
+                             out + g * per_group<Float>);
+  }
+  for (; g < n_groups; ++g) {
+    block_avx512<1>(rk, stream, pos + g * group, out + g * per_group<Float>);
+  }
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif  // KAKUHEN_SIMD_X86
+
+/// `n_groups` groups of uniform numbers at the active instruction-set level
+template <typename Float>
+void fill_groups(Philox4x32::key_type key, std::uint64_t stream,
+                 std::uint64_t pos, std::size_t n_groups, Float* out) noexcept {
+#ifdef KAKUHEN_SIMD_X86
+  if constexpr (std::is_same_v<Float, double> || std::is_same_v<Float, float>) {
+    switch (simd::level()) {
+      case simd::Level::avx512:
+        return groups_avx512(key, stream, pos, n_groups, out);
+      case simd::Level::avx2:
+        return groups_avx2(key, stream, pos, n_groups, out);
+      case simd::Level::scalar:
+        break;
+    }
+  }
+#endif
+  scalar_groups(key, stream, pos, n_groups, out);
+}
+
+}  // namespace philox
+
+/// Counter-based random stream built on Philox4x32-10.
+///
+/// The 64-bit `seed` is the key and the counter consists of the 64-bit
+/// stream id and the 64-bit position within the stream, so the numbers of
+/// any (seed, stream, position) are computed directly: independent streams
+/// for threads, chunks or processes need neither jump-ahead nor shared
+/// state, and blocks of counters are generated in SIMD lanes.
+class PhiloxStream {
+ public:
+  explicit PhiloxStream(std::uint64_t seed = 0,
+                        std::uint64_t stream = 0) noexcept {
+    reset(seed, stream);
+  }
+
+  /// select stream `stream` of `seed`, positioned at counter 0
+  void reset(std::uint64_t seed, std::uint64_t stream) noexcept {
+    key_ = {std::uint32_t(seed), std::uint32_t(seed >> 32)};
+    stream_ = stream;
+    seek(0);
+  }
+
+  /// continue at counter `pos`
+  void seek(std::uint64_t pos) noexcept {
+    pos_ = pos;
+    avail_ = 0;
+  }
+  std::uint64_t position() const noexcept { return pos_; }
+  std::uint64_t stream() const noexcept { return stream_; }
+
+  /// next 64 random bits (two per counter)
+  std::uint64_t next() noexcept {
+    if (avail_ == 0) {
+      const std::uint64_t p = pos_++;
+      const auto c = Philox4x32::apply(
+          {std::uint32_t(p), std::uint32_t(p >> 32), std::uint32_t(stream_),
+           std::uint32_t(stream_ >> 32)},
+          key_);
+      buffer_[0] = (std::uint64_t(c[1]) << 32) | c[0];
+      buffer_[1] = (std::uint64_t(c[3]) << 32) | c[2];
+      avail_ = 2;
+    }
+    return buffer_[2 - avail_--];
+  }
+
+  template <typename Float>
+  Float uniform() noexcept {
+    if constexpr (sizeof(Float) <= sizeof(float)) {
+      return Float(philox::to_float(std::uint32_t(next() >> 32)));
+    } else {
+      return Float(philox::to_double(next()));
+    }
+  }
+
+  /// Fill `u[0, n)` with uniform numbers in [0, 1).  The stream is consumed
+  /// in whole groups of `philox::group` counters starting at a fresh
+  /// counter, independently of the instruction-set level.
+  template <typename Float>
+  void fill_uniform(Float* u, std::size_t n) noexcept {
+    constexpr std::size_t per_group = philox::per_group<Float>;
+    const std::size_t n_groups = n / per_group;
+    philox::fill_groups(key_, stream_, pos_, n_groups, u);
+    pos_ += n_groups * philox::group;
+    avail_ = 0;
+    if (const std::size_t i = n_groups * per_group; i < n) {
+      Float tail[per_group];
+      philox::fill_groups(key_, stream_, pos_, 1, tail);
+      pos_ += philox::group;
+      std::copy(tail, tail + (n - i), u + i);
+    }
+  }
+
+ private:
+  Philox4x32::key_type key_{};
+  std::uint64_t stream_ = 0;
+  std::uint64_t pos_ = 0;
+  std::uint64_t buffer_[2] = {0, 0};
+  int avail_ = 0;
+};
+
+}  // namespace kakuhen
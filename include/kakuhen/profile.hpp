@@ -0,0 +1,253 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace kakuhen {
+
+/// Stage timers of the integrator, compiled in by defining
+/// `KAKUHEN_PROFILE`; without it every timer is empty and the profile
+/// stays empty.
+#ifdef KAKUHEN_PROFILE
+inline constexpr bool profiling = true;
+#else
+inline constexpr bool profiling = false;
+#endif
+
+/// Stages of the hot path that the time of a worker is attributed to.
+enum class Stage : std::uint8_t {
+  /// filling the blocks with uniform random numbers
+  rng,
+  /// map of the uniform numbers through the 1D grids (including the
+  /// defensive mixture)
+  grid,
+  /// draw of the bins conditional on the parent bins
+  conditional,
+  /// the integrand
+  integrand,
+  /// sums, refinement histograms, weight sketch, observable histograms
+  /// and unweighting of the evaluated blocks
+  accumulation,
+  /// merge of the histograms and refinement of the grids and tables
+  refinement,
+};
+
+inline constexpr std::size_t n_stages = 6;
+
+inline const char* stage_name(Stage s) noexcept {
+  static const char* names[n_stages] = {"rng",        "grid",
+                                        "conditional", "integrand",
+                                        "accumulation", "refinement"};
+  return names[std::size_t(s)];
+}
+
+/// accumulated time and number of timed sections of one stage
+struct StageTime {
+  std::uint64_t ns = 0;
+  std::uint64_t calls = 0;
+};
+
+using StageTimes = std::array<StageTime, n_stages>;
+
+inline StageTimes& operator+=(StageTimes& a, const StageTimes& b) noexcept {
+  for (std::size_t s = 0; s < n_stages; ++s) {
+    a[s].ns += b[s].ns;
+    a[s].calls += b[s].calls;
+  }
+  return a;
+}
+
+inline StageTimes operator-(StageTimes a, const StageTimes& b) noexcept {
+  for (std::size_t s = 0; s < n_stages; ++s) {
+    a[s].ns -= b[s].ns;
+    a[s].calls -= b[s].calls;
+  }
+  return a;
+}
+
+/// Span of the trace of a run: a chunk or a refinement on one thread, with
+/// the stage times within it.
+struct TraceEvent {
+  const char* name;
+  std::uint32_t thread;
+  /// start relative to the construction of the integrator and duration
+  std::int64_t start_ns;
+  std::int64_t duration_ns;
+  StageTimes stages;
+};
+
+/// Stage times and trace events of one thread.
+class ThreadProfile {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  void add(Stage s, clock::duration d) noexcept {
+    StageTime& t = times_[std::size_t(s)];
+    t.ns += std::uint64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    ++t.calls;
+  }
+
+  const StageTimes& times() const noexcept { return times_; }
+
+  void clear() noexcept {
+    times_ = StageTimes{};
+    events.clear();
+  }
+
+  std::vector<TraceEvent> events;
+
+ private:
+  StageTimes times_{};
+};
+
+/// Attributes the time since the previous lap (or the construction) to a
+/// stage; does nothing unless `profiling`.
+class Stopwatch {
+ public:
+  using clock = ThreadProfile::clock;
+
+  explicit Stopwatch(ThreadProfile& profile) noexcept : profile_(profile) {
+    if constexpr (profiling) last_ = clock::now();
+  }
+
+  void lap(Stage s) noexcept {
+    if constexpr (profiling) {
+      const clock::time_point now = clock::now();
+      profile_.add(s, now - last_);
+      last_ = now;
+    }
+  }
+
+ private:
+  ThreadProfile& profile_;
+  clock::time_point last_;
+};
+
+/// Records the span from its construction to `close` as a trace event of
+/// the profile, with the stage times lapped within it; does nothing unless
+/// `profiling`.
+class TraceSpan {
+ public:
+  using clock = ThreadProfile::clock;
+
+  explicit TraceSpan(ThreadProfile& profile) noexcept : profile_(profile) {
+    if constexpr (profiling) {
+      start_ = clock::now();
+      before_ = profile.times();
+    }
+  }
+
+  /// `epoch`: origin of the time line of the trace
+  void close(const char* name, std::size_t thread, clock::time_point epoch) {
+    if constexpr (profiling) {
+      using std::chrono::duration_cast;
+      using std::chrono::nanoseconds;
+      const clock::time_point now = clock::now();
+      profile_.events.push_back(
+          {name, std::uint32_t(thread),
+           duration_cast<nanoseconds>(start_ - epoch).count(),
+           duration_cast<nanoseconds>(now - start_).count(),
+           profile_.times() - before_});
+    }
+  }
+
+ private:
+  ThreadProfile& profile_;
+  clock::time_point start_;
+  StageTimes before_{};
+};
+
+/// Stage times of every thread for one iteration (and the refinements
+/// since the previous one).
+struct IterationProfile {
+  std::uint64_t iteration = 0;
+  std::uint64_t n_samples = 0;
+  std::vector<StageTimes> threads;
+
+  StageTimes total() const noexcept {
+    StageTimes t{};
+    for (const StageTimes& s : threads) t += s;
+    return t;
+  }
+};
+
+namespace detail {
+inline void write_stages(std::ostream& out, const StageTimes& t) {
+  out << '{';
+  for (std::size_t s = 0; s < n_stages; ++s) {
+    out << (s ? ", " : "") << '"' << stage_name(Stage(s)) << "\": {\"ns\": "
+        << t[s].ns << ", \"calls\": " << t[s].calls << '}';
+  }
+  out << '}';
+}
+
+/// nanoseconds as microseconds with three decimals
+inline void write_us(std::ostream& out, std::int64_t ns) {
+  if (ns < 0) {
+    out << '-';
+    ns = -ns;
+  }
+  const std::int64_t frac = ns % 1000;
+  out << ns / 1000 << '.' << char('0' + frac / 100)
+      << char('0' + frac / 10 % 10) << char('0' + frac % 10);
+}
+}  // namespace detail
+
+/// Write the stage times per iteration and thread, and their totals, as
+/// JSON.
+inline void write_profile_json(std::ostream& out,
+                               const std::vector<IterationProfile>& log) {
+  StageTimes all{};
+  out << "{\n  \"iterations\": [";
+  for (std::size_t k = 0; k < log.size(); ++k) {
+    const IterationProfile& it = log[k];
+    out << (k ? "," : "") << "\n    {\"iteration\": " << it.iteration
+        << ", \"samples\": " << it.n_samples << ",\n     \"threads\": [";
+    for (std::size_t w = 0; w < it.threads.size(); ++w) {
+      out << (w ? ",\n                 " : "");
+      detail::write_stages(out, it.threads[w]);
+    }
+    const StageTimes total = it.total();
+    all += total;
+    out << "],\n     \"total\": ";
+    detail::write_stages(out, total);
+    out << '}';
+  }
+  out << "\n  ],\n  \"total\": ";
+  detail::write_stages(out, all);
+  out << "\n}\n";
+}
+
+/// Write `events` in the Chrome trace-event format (complete events, one
+/// track per thread, the stage times in the arguments), which e.g.
+/// chrome://tracing and Perfetto display as a timeline.
+inline void write_chrome_trace(std::ostream& out,
+                               const std::vector<TraceEvent>& events) {
+  out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+  for (std::size_t k = 0; k < events.size(); ++k) {
+    const TraceEvent& e = events[k];
+    out << (k ? "," : "") << "\n  {\"name\": \"" << e.name
+        << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << e.thread
+        << ", \"ts\": ";
+    detail::write_us(out, e.start_ns);
+    out << ", \"dur\": ";
+    detail::write_us(out, e.duration_ns);
+    out << ", \"args\": {";
+    bool first = true;
+    for (std::size_t s = 0; s < n_stages; ++s) {
+      if (e.stages[s].calls == 0) continue;
+      out << (first ? "" : ", ") << '"' << stage_name(Stage(s))
+          << "_ns\": " << e.stages[s].ns;
+      first = false;
+    }
+    out << "}}";
+  }
+  out << "\n]}\n";
+}
+
+}  // namespace kakuhen
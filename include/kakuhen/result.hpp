@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <ostream>
+
+namespace kakuhen {
+
+/// Monte Carlo estimate of a single iteration.
+struct Estimate {
+  double value = 0.;
+  double error = 0.;
+  std::uint64_t n_samples = 0;
+};
+
+/// Sample sums of one iteration from which an `Estimate` is formed.
+struct Sums {
+  double sum = 0.;
+  double sum2 = 0.;
+  /// sum of |f * w|, i.e. the estimate of the integral of |f|
+  double sum_abs = 0.;
+  /// largest |f * w|
+  double max_abs = 0.;
+  std::uint64_t n = 0;
+
+  void add(double fw) noexcept {
+    sum += fw;
+    sum2 += fw * fw;
+    sum_abs += std::abs(fw);
+    max_abs = std::max(max_abs, std::abs(fw));
+    ++n;
+  }
+
+  Sums& operator+=(const Sums& other) noexcept {
+    sum += other.sum;
+    sum2 += other.sum2;
+    sum_abs += other.sum_abs;
+    max_abs = std::max(max_abs, other.max_abs);
+    n += other.n;
+    return *this;
+  }
+
+  Estimate estimate() const noexcept {
+    Estimate est;
+    est.n_samples = n;
+    if (n == 0) return est;
+    const double dn = double(n);
+    est.value = sum / dn;
+    if (n > 1) {
+      const double var = (sum2 / dn - est.value * est.value) / (dn - 1.);
+      est.error = var > 0. ? std::sqrt(var) : 0.;
+    }
+    return est;
+  }
+};
+
+/// Inverse-variance weighted combination of the estimates of several
+/// iterations together with the chi^2 per degree of freedom of their
+/// compatibility.
+class Result {
+ public:
+  /// weight of an iteration in the combination, also used for the bins
+  /// of `Histograms`
+  static double weight(const Estimate& est) noexcept {
+    return 1. /
+           std::max(est.error * est.error, std::numeric_limits<double>::min());
+  }
+
+  void add(const Estimate& est) noexcept {
+    const double w = weight(est);
+    sum_w_ += w;
+    sum_wv_ += w * est.value;
+    sum_wv2_ += w * est.value * est.value;
+    n_samples_ += est.n_samples;
+    ++n_iter_;
+  }
+
+  void clear() noexcept { *this = Result{}; }
+
+  double value() const noexcept { return n_iter_ > 0 ? sum_wv_ / sum_w_ : 0.; }
+  double error() const noexcept {
+    return n_iter_ > 0 ? std::sqrt(1. / sum_w_) : 0.;
+  }
+  double chi2dof() const noexcept {
+    if (n_iter_ < 2) return 0.;
+    const double v = value();
+    const double chi2 = sum_wv2_ - sum_w_ * v * v;
+    return std::max(chi2, 0.) / double(n_iter_ - 1);
+  }
+  std::size_t n_iterations() const noexcept { return n_iter_; }
+  std::uint64_t n_samples() const noexcept { return n_samples_; }
+
+  /// binary form: the sums of the combination (double x 3, uint64 x 2) in
+  /// the byte order of the machine
+  void write(std::ostream& out) const {
+    const double sums[3] = {sum_w_, sum_wv_, sum_wv2_};
+    const std::uint64_t counts[2] = {n_samples_, std::uint64_t(n_iter_)};
+    out.write(reinterpret_cast<const char*>(sums), sizeof sums);
+    out.write(reinterpret_cast<const char*>(counts), sizeof counts);
+  }
+
+  /// reads the form of `write`; leaves `in` failed if it is truncated
+  void read(std::istream& in) {
+    double sums[3];
+    std::uint64_t counts[2];
+    in.read(reinterpret_cast<char*>(sums), sizeof sums);
+    in.read(reinterpret_cast<char*>(counts), sizeof counts);
+    if (!in) return;
+    sum_w_ = sums[0];
+    sum_wv_ = sums[1];
+    sum_wv2_ = sums[2];
+    n_samples_ = counts[0];
+    n_iter_ = std::size_t(counts[1]);
+  }
+
+ private:
+  double sum_w_ = 0.;
+  double sum_wv_ = 0.;
+  double sum_wv2_ = 0.;
+  std::uint64_t n_samples_ = 0;
+  std::size_t n_iter_ = 0;
+};
+
+}  // namespace kakuhen
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+
+namespace kakuhen {
+
+/// 64-bit finaliser of SplitMix64 (a bijective mixing function)
+constexpr std::uint64_t mix64(std::uint64_t z) noexcept {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/// bits of `x` in reverse order, i.e. 2^32 times the base-2 radical
+/// inverse of `x`
+constexpr std::uint32_t reverse_bits(std::uint32_t x) noexcept {
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+  x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+/// seed of the independent stream `(i, j)` derived from a master `seed`
+constexpr std::uint64_t stream_seed(std::uint64_t seed, std::uint64_t i,
+                                    std::uint64_t j) noexcept {
+  return mix64(seed ^ mix64(i ^ mix64(j + 0x9e3779b97f4a7c15ULL)));
+}
+
+/// SplitMix64: used to expand a single 64-bit seed into generator state.
+class SplitMix64 {
+ public:
+  explicit constexpr SplitMix64(std::uint64_t seed) noexcept : state_(seed) {}
+
+  constexpr std::uint64_t next() noexcept {
+    return mix64(state_ += 0x9e3779b97f4a7c15ULL);
+  }
+
+ private:
+  std::uint64_t state_;
+};
+
+/// xoshiro256++ (Blackman & Vigna): small-state, fast general purpose PRNG.
+class Xoshiro256pp {
+ public:
+  using result_type = std::uint64_t;
+
+  explicit Xoshiro256pp(std::uint64_t seed = 0) noexcept { this->seed(seed); }
+
+  void seed(std::uint64_t seed) noexcept {
+    SplitMix64 sm(seed);
+    for (auto& s : s_) s = sm.next();
+  }
+
+  static constexpr result_type min() noexcept { return 0; }
+  static constexpr result_type max() noexcept { return ~result_type(0); }
+
+  result_type operator()() noexcept { return next(); }
+
+  result_type next() noexcept {
+    const std::uint64_t result = rotl(s_[0] + s_[3], 23) + s_[0];
+    const std::uint64_t t = s_[1] << 17;
+    s_[2] ^= s_[0];
+    s_[3] ^= s_[1];
+    s_[1] ^= s_[2];
+    s_[0] ^= s_[3];
+    s_[2] ^= t;
+    s_[3] = rotl(s_[3], 45);
+    return result;
+  }
+
+  /// uniform number in [0, 1) using the top mantissa bits
+  template <typename Float>
+  Float uniform() noexcept {
+    return to_uniform<Float>(next());
+  }
+
+  template <typename Float>
+  static constexpr Float to_uniform(std::uint64_t r) noexcept {
+    if constexpr (sizeof(Float) <= sizeof(float)) {
+      return Float(r >> 40) * Float(0x1.0p-24);
+    } else {
+      return Float(r >> 11) * Float(0x1.0p-53);
+    }
+  }
+
+ private:
+  static constexpr std::uint64_t rotl(std::uint64_t x, int k) noexcept {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  std::uint64_t s_[4];
+};
+
+}  // namespace kakuhen
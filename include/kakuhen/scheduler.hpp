@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace kakuhen {
+
+/// Work-stealing distribution of the index range `[0, n)` over a fixed set
+/// of workers.
+///
+/// Every worker starts out owning a contiguous slice of the range and takes
+/// tasks of `grain` consecutive indices from its front.  A worker whose
+/// slice is exhausted steals the back half of the largest remaining slice
+/// of another worker, so that expensive regions of the range are shared out
+/// instead of leaving the other workers idle at the end.  Each slice is a
+/// single 64-bit word (begin, end) updated with compare-and-swap; the
+/// scheduler is lock-free and does not allocate after construction.
+class WorkStealingScheduler {
+ public:
+  explicit WorkStealingScheduler(std::size_t n_workers)
+      : n_workers_(std::max<std::size_t>(n_workers, 1)),
+        slices_(std::make_unique<Slice[]>(n_workers_)) {}
+
+  std::size_t n_workers() const noexcept { return n_workers_; }
+
+  /// Partition `[0, n)` evenly; must not overlap with calls to `next`.
+  void reset(std::uint32_t n, std::uint32_t grain) noexcept {
+    grain_ = std::max<std::uint32_t>(grain, 1);
+    for (std::size_t w = 0; w < n_workers_; ++w) {
+      const auto begin = std::uint32_t(std::uint64_t(n) * w / n_workers_);
+      const auto end = std::uint32_t(std::uint64_t(n) * (w + 1) / n_workers_);
+      slices_[w].range.store(pack(begin, end), std::memory_order_relaxed);
+    }
+  }
+
+  /// Next task `[begin, end)` of worker `w`; `false` once the whole range
+  /// has been handed out.
+  bool next(std::size_t w, std::uint32_t& begin, std::uint32_t& end) noexcept {
+    std::atomic<std::uint64_t>& own = slices_[w].range;
+    for (;;) {
+      std::uint64_t r = own.load(std::memory_order_acquire);
+      while (lo(r) < hi(r)) {
+        const std::uint32_t b = lo(r);
+        const std::uint32_t e = std::min(hi(r), b + grain_);
+        if (own.compare_exchange_weak(r, pack(e, hi(r)),
+                                      std::memory_order_acq_rel)) {
+          begin = b;
+          end = e;
+          return true;
+        }
+      }
+      if (!steal(w)) return false;
+    }
+  }
+
+ private:
+  struct alignas(64) Slice {
+    std::atomic<std::uint64_t> range{0};
+  };
+
+  static constexpr std::uint64_t pack(std::uint32_t b, std::uint32_t e) {
+    return (std::uint64_t(e) << 32) | b;
+  }
+  static constexpr std::uint32_t lo(std::uint64_t r) { return std::uint32_t(r); }
+  static constexpr std::uint32_t hi(std::uint64_t r) {
+    return std::uint32_t(r >> 32);
+  }
+
+  /// move the back half of the largest foreign slice into the (empty) slice
+  /// of worker `w`; `false` if there is nothing left to steal
+  bool steal(std::size_t w) noexcept {
+    for (;;) {
+      std::size_t victim = w;
+      std::uint64_t r = 0;
+      std::uint32_t largest = 0;
+      for (std::size_t v = 0; v < n_workers_; ++v) {
+        if (v == w) continue;
+        const std::uint64_t rv = slices_[v].range.load(std::memory_order_acquire);
+        if (lo(rv) < hi(rv) && hi(rv) - lo(rv) > largest) {
+          largest = hi(rv) - lo(rv);
+          victim = v;
+          r = rv;
+        }
+      }
+      if (victim == w) return false;
+      const std::uint32_t mid = lo(r) + (hi(r) - lo(r)) / 2;
+      if (slices_[victim].range.compare_exchange_strong(
+              r, pack(lo(r), mid), std::memory_order_acq_rel)) {
+        slices_[w].range.store(pack(mid, hi(r)), std::memory_order_release);
+        return true;
+      }
+    }
+  }
+
+  std::size_t n_workers_;
+  std::unique_ptr<Slice[]> slices_;
+  std::uint32_t grain_ = 1;
+};
+
+}  // namespace kakuhen
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if !defined(KAKUHEN_DISABLE_SIMD) && defined(__x86_64__) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define KAKUHEN_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace kakuhen::simd {
+
+/// Instruction-set levels of the sampling kernels.
+enum class Level : int { scalar = 0, avx2 = 1, avx512 = 2 };
+
+/// highest level supported by the CPU we are running on
+inline Level detect() noexcept {
+#ifdef KAKUHEN_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return Level::avx512;
+  if (__builtin_cpu_supports("avx2")) return Level::avx2;
+#endif
+  return Level::scalar;
+}
+
+namespace detail {
+inline std::atomic<int>& level_storage() noexcept {
+  static std::atomic<int> level{int(detect())};
+  return level;
+}
+}  // namespace detail
+
+/// level used by the kernels; defaults to `detect()`
+inline Level level() noexcept {
+  return Level(detail::level_storage().load(std::memory_order_relaxed));
+}
+
+/// Restrict the kernels to `lvl` (clamped to what the CPU supports), e.g. to
+/// compare against the scalar code path.  All levels produce bit-identical
+/// results: the kernels do not contract multiply-adds.
+inline void set_level(Level lvl) noexcept {
+  detail::level_storage().store(std::min(int(lvl), int(detect())),
+                                std::memory_order_relaxed);
+}
+
+// The multiply-adds in the kernels must stay unfused so that every level
+// reproduces the scalar results bit by bit, whatever -ffp-contract says.
+#if defined(__clang__)
+#define KAKUHEN_NO_FMA_FN
+#define KAKUHEN_NO_CONTRACT _Pragma("clang fp contract(off)")
+#elif defined(__GNUC__)
+#define KAKUHEN_NO_FMA_FN __attribute__((optimize("fp-contract=off")))
+#define KAKUHEN_NO_CONTRACT
+#else
+#define KAKUHEN_NO_FMA_FN
+#define KAKUHEN_NO_CONTRACT
+#endif
+
+// -- scalar reference kernels -----------------------------------------------
+
+namespace scalar {
+
+template <typename Float>
+KAKUHEN_NO_FMA_FN void map_uniform(const Float* edges, const Float* widths,
+                                   std::uint32_t nb, const Float* u,
+                                   std::size_t n, Float* x, std::uint32_t* bin,
+                                   Float* w) noexcept {
+  KAKUHEN_NO_CONTRACT
+  const Float fnb = Float(nb);
+  for (std::size_t i = 0; i < n; ++i) {
+    const Float ub = u[i] * fnb;
+    const std::uint32_t b = std::min(std::uint32_t(ub), nb - 1);
+    const Float frac = ub - Float(b);
+    x[i] = edges[b] + frac * widths[b];
+    w[i] *= widths[b] * fnb;
+    bin[i] = b;
+  }
+}
+
+template <typename Float>
+KAKUHEN_NO_FMA_FN void map_bins(const Float* edges, const Float* widths,
+                                const std::uint32_t* bin, const Float* frac,
+                                const Float* prob, std::size_t n, Float* x,
+                                Float* w) noexcept {
+  KAKUHEN_NO_CONTRACT
+  for (std::size_t i = 0; i < n; ++i) {
+    const std::uint32_t b = bin[i];
+    x[i] = edges[b] + frac[i] * widths[b];
+    w[i] *= widths[b] / prob[i];
+  }
+}
+
+}  // namespace scalar
+
+// -- AVX2 / AVX-512 kernels -------------------------------------------------
+
+#ifdef KAKUHEN_SIMD_X86
+#if defined(__GNUC__) && !defined(__clang__)
+// false positives on the `_mm*_undefined_*` idiom of the intrinsic headers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+namespace x86 {
+
+#define KAKUHEN_TARGET(isa) __attribute__((target(isa))) KAKUHEN_NO_FMA_FN
+
+KAKUHEN_TARGET("avx2")
+inline std::size_t map_uniform_avx2(const double* edges, const double* widths,
+                                    std::uint32_t nb, const double* u,
+                                    std::size_t n, double* x,
+                                    std::uint32_t* bin, double* w) noexcept {
+  KAKUHEN_NO_CONTRACT
+  const __m256d vnb = _mm256_set1_pd(double(nb));
+  const __m128i vmax = _mm_set1_epi32(int(nb - 1));
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256d ub = _mm256_mul_pd(_mm256_loadu_pd(u + i), vnb);
+    const __m128i b = _mm_min_epi32(_mm256_cvttpd_epi32(ub), vmax);
+    const __m256d frac = _mm256_sub_pd(ub, _mm256_cvtepi32_pd(b));
+    const __m256d e = _mm256_i32gather_pd(edges, b, 8);
+    const __m256d wd = _mm256_i32gather_pd(widths, b, 8);
+    _mm256_storeu_pd(x + i, _mm256_add_pd(e, _mm256_mul_pd(frac, wd)));
+    _mm256_storeu_pd(
+        w + i, _mm256_mul_pd(_mm256_loadu_pd(w + i), _mm256_mul_pd(wd, vnb)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(bin + i), b);
+  }
+  return i;
+}
+
+KAKUHEN_TARGET("avx2")
+inline std::size_t map_uniform_avx2(const float* edges, const float* widths,
+                                    std::uint32_t nb, const float* u,
+                                    std::size_t n, float* x, std::uint32_t* bin,
+                                    float* w) noexcept {
+  KAKUHEN_NO_CONTRACT
+  const __m256 vnb = _mm256_set1_ps(float(nb));
+  const __m256i vmax = _mm256_set1_epi32(int(nb - 1));
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 ub = _mm256_mul_ps(_mm256_loadu_ps(u + i), vnb);
+    const __m256i b = _mm256_min_epi32(_mm256_cvttps_epi32(ub), vmax);
+    const __m256 frac = _mm256_sub_ps(ub, _mm256_cvtepi32_ps(b));
+    const __m256 e = _mm256_i32gather_ps(edges, b, 4);
+    const __m256 wd = _mm256_i32gather_ps(widths, b, 4);
+    _mm256_storeu_ps(x + i, _mm256_add_ps(e, _mm256_mul_ps(frac, wd)));
+    _mm256_storeu_ps(
+        w + i, _mm256_mul_ps(_mm256_loadu_ps(w + i), _mm256_mul_ps(wd, vnb)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(bin + i), b);
+  }
+  return i;
+}
+
+KAKUHEN_TARGET("avx2")
+inline std::size_t map_bins_avx2(const double* edges, const double* widths,
+                                 const std::uint32_t* bin, const double* frac,
+                                 const double* prob, std::size_t n, double* x,
+                                 double* w) noexcept {
+  KAKUHEN_NO_CONTRACT
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(bin + i));
+    const __m256d e = _mm256_i32gather_pd(edges, b, 8);
+    const __m256d wd = _mm256_i32gather_pd(widths, b, 8);
+    _mm256_storeu_pd(
+        x + i, _mm256_add_pd(e, _mm256_mul_pd(_mm256_loadu_pd(frac + i), wd)));
+    const __m256d jac = _mm256_div_pd(wd, _mm256_loadu_pd(prob + i));
+    _mm256_storeu_pd(w + i, _mm256_mul_pd(_mm256_loadu_pd(w + i), jac));
+  }
+  return i;
+}
+
+KAKUHEN_TARGET("avx2")
+inline std::size_t map_bins_avx2(const float* edges, const float* widths,
+                                 const std::uint32_t* bin, const float* frac,
+                                 const float* prob, std::size_t n, float* x,
+                                 float* w) noexcept {
+  KAKUHEN_NO_CONTRACT
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bin + i));
+    const __m256 e = _mm256_i32gather_ps(edges, b, 4);
+    const __m256 wd = _mm256_i32gather_ps(widths, b, 4);
+    _mm256_storeu_ps(
+        x + i, _mm256_add_ps(e, _mm256_mul_ps(_mm256_loadu_ps(frac + i), wd)));
+    const __m256 jac = _mm256_div_ps(wd, _mm256_loadu_ps(prob + i));
+    _mm256_storeu_ps(w + i, _mm256_mul_ps(_mm256_loadu_ps(w + i), jac));
+  }
+  return i;
+}
+
+KAKUHEN_TARGET("avx512f")
+inline std::size_t map_uniform_avx512(const double* edges,
+                                      const double* widths, std::uint32_t nb,
+                                      const double* u, std::size_t n,
+                                      double* x, std::uint32_t* bin,
+                                      double* w) noexcept {
+  KAKUHEN_NO_CONTRACT
+  const __m512d vnb = _mm512_set1_pd(double(nb));
+  const __m256i vmax = _mm256_set1_epi32(int(nb - 1));
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m512d ub = _mm512_mul_pd(_mm512_loadu_pd(u + i), vnb);
+    const __m256i b = _mm256_min_epi32(_mm512_cvttpd_epi32(ub), vmax);
+    const __m512d frac = _mm512_sub_pd(ub, _mm512_cvtepi32_pd(b));
+    const __m512d e = _mm512_i32gather_pd(b, edges, 8);
+    const __m512d wd = _mm512_i32gather_pd(b, widths, 8);
+    _mm512_storeu_pd(x + i, _mm512_add_pd(e, _mm512_mul_pd(frac, wd)));
+    _mm512_storeu_pd(
+        w + i, _mm512_mul_pd(_mm512_loadu_pd(w + i), _mm512_mul_pd(wd, vnb)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(bin + i), b);
+  }
+  return i;
+}
+
+KAKUHEN_TARGET("avx512f")
+inline std::size_t map_uniform_avx512(const float* edges, const float* widths,
+                                      std::uint32_t nb, const float* u,
+                                      std::size_t n, float* x,
+                                      std::uint32_t* bin, float* w) noexcept {
+  KAKUHEN_NO_CONTRACT
+  const __m512 vnb = _mm512_set1_ps(float(nb));
+  const __m512i vmax = _mm512_set1_epi32(int(nb - 1));
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512 ub = _mm512_mul_ps(_mm512_loadu_ps(u + i), vnb);
+    const __m512i b = _mm512_min_epi32(_mm512_cvttps_epi32(ub), vmax);
+    const __m512 frac = _mm512_sub_ps(ub, _mm512_cvtepi32_ps(b));
+    const __m512 e = _mm512_i32gather_ps(b, edges, 4);
+    const __m512 wd = _mm512_i32gather_ps(b, widths, 4);
+    _mm512_storeu_ps(x + i, _mm512_add_ps(e, _mm512_mul_ps(frac, wd)));
+    _mm512_storeu_ps(
+        w + i, _mm512_mul_ps(_mm512_loadu_ps(w + i), _mm512_mul_ps(wd, vnb)));
+    _mm512_storeu_si512(bin + i, b);
+  }
+  return i;
+}
+
+KAKUHEN_TARGET("avx512f")
+inline std::size_t map_bins_avx512(const double* edges, const double* widths,
+                                   const std::uint32_t* bin,
+                                   const double* frac, const double* prob,
+                                   std::size_t n, double* x,
+                                   double* w) noexcept {
+  KAKUHEN_NO_CONTRACT
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bin + i));
+    const __m512d e = _mm512_i32gather_pd(b, edges, 8);
+    const __m512d wd = _mm512_i32gather_pd(b, widths, 8);
+    _mm512_storeu_pd(
+        x + i, _mm512_add_pd(e, _mm512_mul_pd(_mm512_loadu_pd(frac + i), wd)));
+    const __m512d jac = _mm512_div_pd(wd, _mm512_loadu_pd(prob + i));
+    _mm512_storeu_pd(w + i, _mm512_mul_pd(_mm512_loadu_pd(w + i), jac));
+  }
+  return i;
+}
+
+KAKUHEN_TARGET("avx512f")
+inline std::size_t map_bins_avx512(const float* edges, const float* widths,
+                                   const std::uint32_t* bin, const float* frac,
+                                   const float* prob, std::size_t n, float* x,
+                                   float* w) noexcept {
+  KAKUHEN_NO_CONTRACT
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512i b = _mm512_loadu_si512(bin + i);
+    const __m512 e = _mm512_i32gather_ps(b, edges, 4);
+    const __m512 wd = _mm512_i32gather_ps(b, widths, 4);
+    _mm512_storeu_ps(
+        x + i, _mm512_add_ps(e, _mm512_mul_ps(_mm512_loadu_ps(frac + i), wd)));
+    const __m512 jac = _mm512_div_ps(wd, _mm512_loadu_ps(prob + i));
+    _mm512_storeu_ps(w + i, _mm512_mul_ps(_mm512_loadu_ps(w + i), jac));
+  }
+  return i;
+}
+
+#undef KAKUHEN_TARGET
+
+}  // namespace x86
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif  // KAKUHEN_SIMD_X86
+
+// -- dispatching entry points -----------------------------------------------
+
+/// Map uniform numbers `u` through a grid with `nb` equally probable bins:
+/// selects the bin, interpolates linearly inside it and multiplies the
+/// Jacobian of the map into `w`.
+template <typename Float>
+void map_uniform(const Float* edges, const Float* widths, std::uint32_t nb,
+                 const Float* u, std::size_t n, Float* x, std::uint32_t* bin,
+                 Float* w) noexcept {
+  std::size_t i = 0;
+#ifdef KAKUHEN_SIMD_X86
+  if constexpr (std::is_same_v<Float, double> || std::is_same_v<Float, float>) {
+    switch (level()) {
+      case Level::avx512:
+        i = x86::map_uniform_avx512(edges, widths, nb, u, n, x, bin, w);
+        break;
+      case Level::avx2:
+        i = x86::map_uniform_avx2(edges, widths, nb, u, n, x, bin, w);
+        break;
+      case Level::scalar:
+        break;
+    }
+  }
+#endif
+  scalar::map_uniform(edges, widths, nb, u + i, n - i, x + i, bin + i, w + i);
+}
+
+/// Place points at the relative position `frac` inside the already selected
+/// bins `bin` and multiply `width / prob` into `w`, where `prob` is the
+/// probability with which the bin was selected.
+template <typename Float>
+void map_bins(const Float* edges, const Float* widths, const std::uint32_t* bin,
+              const Float* frac, const Float* prob, std::size_t n, Float* x,
+              Float* w) noexcept {
+  std::size_t i = 0;
+#ifdef KAKUHEN_SIMD_X86
+  if constexpr (std::is_same_v<Float, double> || std::is_same_v<Float, float>) {
+    switch (level()) {
+      case Level::avx512:
+        i = x86::map_bins_avx512(edges, widths, bin, frac, prob, n, x, w);
+        break;
+      case Level::avx2:
+        i = x86::map_bins_avx2(edges, widths, bin, frac, prob, n, x, w);
+        break;
+      case Level::scalar:
+        break;
+    }
+  }
+#endif
+  scalar::map_bins(edges, widths, bin + i, frac + i, prob + i, n - i, x + i,
+                   w + i);
+}
+
+#undef KAKUHEN_NO_FMA_FN
+#undef KAKUHEN_NO_CONTRACT
+
+}  // namespace kakuhen::simd
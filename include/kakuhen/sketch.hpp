@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "kakuhen/accumulator.hpp"
+
+namespace kakuhen {
+
+/// Mergeable quantile sketch of the magnitudes of the weights |f w|.
+///
+/// Values fall into logarithmic buckets taken from the bits of the double:
+/// the exponent and the leading `mantissa_bits` bits of the mantissa, i.e.
+/// 128 buckets per factor of two and a relative accuracy of 2^-7 for every
+/// quantile.  The buckets hold integer counts in a `SparseHistogram`, so
+/// sketches merge exactly: the result is the same for any distribution of
+/// the values over threads or processes and any order of merging.  Zero
+/// and non-finite values are not recorded.
+class WeightSketch {
+ public:
+  static constexpr unsigned mantissa_bits = 7;
+
+  WeightSketch() : buckets_(256) {}
+
+  /// number of recorded values
+  std::uint64_t count() const noexcept { return count_; }
+
+  void clear() noexcept {
+    buckets_.clear();
+    count_ = 0;
+  }
+
+  void add(double v) {
+    v = std::abs(v);
+    if (!(v > 0.) || !std::isfinite(v)) return;
+    buckets_.add(bucket(v), 1);
+    ++count_;
+  }
+
+  WeightSketch& operator+=(const WeightSketch& other) {
+    other.buckets_.for_each([this](std::uint32_t b, std::uint64_t n) {
+      buckets_.add(b, n);
+    });
+    count_ += other.count_;
+    return *this;
+  }
+
+  /// Upper edge of the bucket holding the `q`-quantile of the recorded
+  /// values, i.e. a value that at least a fraction `q` of them do not
+  /// exceed (within the relative accuracy); 0 if the sketch is empty.
+  double quantile(double q) const {
+    const auto sorted = buckets();
+    if (sorted.empty()) return 0.;
+    const double rank = std::clamp(q, 0., 1.) * double(count_);
+    std::uint64_t below = 0;
+    for (const auto& [b, n] : sorted) {
+      below += n;
+      if (double(below) >= rank) return upper_edge(b);
+    }
+    return upper_edge(sorted.back().first);
+  }
+
+  /// (bucket, count) pairs in increasing order of the bucket
+  std::vector<std::pair<std::uint32_t, std::uint64_t>> buckets() const {
+    std::vector<std::pair<std::uint32_t, std::uint64_t>> out;
+    out.reserve(buckets_.size());
+    buckets_.for_each(
+        [&out](std::uint32_t b, std::uint64_t n) { out.emplace_back(b, n); });
+    std::sort(out.begin(), out.end());
+    return out;
+  }
+
+  /// binary form: count of buckets, then (bucket, count) pairs in
+  /// increasing order, as uint64 in the byte order of the machine
+  void write(std::ostream& out) const {
+    const auto sorted = buckets();
+    const std::uint64_t n = sorted.size();
+    out.write(reinterpret_cast<const char*>(&n), sizeof n);
+    for (const auto& [b, c] : sorted) {
+      const std::uint64_t entry[2] = {b, c};
+      out.write(reinterpret_cast<const char*>(entry), sizeof entry);
+    }
+  }
+
+  /// reads the form of `write`; leaves `in` failed if it is truncated
+  void read(std::istream& in) {
+    clear();
+    std::uint64_t n = 0;
+    if (!in.read(reinterpret_cast<char*>(&n), sizeof n)) return;
+    for (std::uint64_t i = 0; i < n; ++i) {
+      std::uint64_t entry[2];
+      if (!in.read(reinterpret_cast<char*>(entry), sizeof entry)) return;
+      buckets_.add(std::uint32_t(entry[0]), entry[1]);
+      count_ += entry[1];
+    }
+  }
+
+ private:
+  static constexpr unsigned shift = 52 - mantissa_bits;
+
+  static std::uint32_t bucket(double v) noexcept {
+    std::uint64_t bits;
+    std::memcpy(&bits, &v, sizeof bits);
+    return std::uint32_t(bits >> shift);
+  }
+
+  static double upper_edge(std::uint32_t b) noexcept {
+    const std::uint64_t bits = std::uint64_t(b + 1) << shift;
+    double v;
+    std::memcpy(&v, &bits, sizeof v);
+    return v;
+  }
+
+  SparseHistogram buckets_;
+  std::uint64_t count_ = 0;
+};
+
+}  // namespace kakuhen
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "kakuhen/grid_file.hpp"
+#include "kakuhen/pairs.hpp"
+#include "kakuhen/result.hpp"
+#include "kakuhen/sketch.hpp"
+
+namespace kakuhen {
+
+/// Refinement data accumulated by an `Integrator` since its last refinement:
+/// the sample sums, the importance histograms of the 1D grids and of the
+/// stored pairs, and the sketch of the weights.
+///
+/// Snapshots of independent runs off the same density (same grid file,
+/// different seeds) are merged with `+=` and fed back to
+/// `Integrator::adapt(const Snapshot&)`, so that a farm of jobs yields one
+/// estimate and one refinement from all of its samples.  The merge is a
+/// plain sum, i.e. deterministic for a fixed order of the snapshots.
+///
+/// The binary form (`write`, `read`) is a fixed header followed by the
+/// pairs and the histograms in the byte order of the writing machine:
+///
+///   magic "KAKUSNAP", version, byte order     char[8], uint32, uint32
+///   dimension, n_bins, n_pairs, reserved      uint32 x 4
+///   density                                   uint64
+///   sum, sum2, sum_abs, max_abs, n            double x 4, uint64
+///   pairs                                     uint32[n_pairs][2]
+///   one                                       double[dimension][n_bins]
+///   pair                                      double[n_pairs][n_bins][n_bins]
+///   weights                                   see `WeightSketch::write`
+struct Snapshot {
+  std::uint32_t dimension = 0;
+  std::uint32_t n_bins = 0;
+  /// fingerprint of the sampling density (`Integrator::density_id`) that
+  /// the histograms refer to
+  std::uint64_t density = 0;
+  Sums sums;
+  std::vector<PairLayout::pair_type> pairs;
+  /// importance per 1D bin [dim][bin] and per pair cell (see `PairLayout`)
+  std::vector<double> one;
+  std::vector<double> pair;
+  /// quantile sketch of |f w|, e.g. to choose the threshold of partial
+  /// unweighting for all runs of a farm
+  WeightSketch weights;
+
+  Estimate estimate() const noexcept { return sums.estimate(); }
+
+  /// `true` if `other` was accumulated with the same density and pairs
+  bool compatible(const Snapshot& other) const noexcept {
+    return dimension == other.dimension && n_bins == other.n_bins &&
+           density == other.density && pairs == other.pairs;
+  }
+
+  /// throws `std::invalid_argument` unless `compatible(other)`
+  Snapshot& operator+=(const Snapshot& other) {
+    if (!compatible(other)) {
+      throw std::invalid_argument(
+          "kakuhen::Snapshot: snapshots of different densities");
+    }
+    sums += other.sums;
+    for (std::size_t i = 0; i < one.size(); ++i) one[i] += other.one[i];
+    for (std::size_t i = 0; i < pair.size(); ++i) pair[i] += other.pair[i];
+    weights += other.weights;
+    return *this;
+  }
+
+  void write(std::ostream& out) const {
+    Header h{};
+    std::memcpy(h.magic, magic, sizeof h.magic);
+    h.version = version;
+    h.byte_order = grid_file::byte_order;
+    h.dimension = dimension;
+    h.n_bins = n_bins;
+    h.n_pairs = std::uint32_t(pairs.size());
+    h.density = density;
+    h.sum = sums.sum;
+    h.sum2 = sums.sum2;
+    h.sum_abs = sums.sum_abs;
+    h.max_abs = sums.max_abs;
+    h.n = sums.n;
+    out.write(reinterpret_cast<const char*>(&h), sizeof h);
+    for (const auto& [i, j] : pairs) {
+      const std::uint32_t p[2] = {i, j};
+      out.write(reinterpret_cast<const char*>(p), sizeof p);
+    }
+    out.write(reinterpret_cast<const char*>(one.data()),
+              std::streamsize(one.size() * sizeof(double)));
+    out.write(reinterpret_cast<const char*>(pair.data()),
+              std::streamsize(pair.size() * sizeof(double)));
+    weights.write(out);
+  }
+
+  /// throws `std::runtime_error` on a malformed or truncated stream, or if
+  /// the header asks for histograms of more than 2^40 bytes
+  static Snapshot read(std::istream& in) {
+    Header h;
+    if (!in.read(reinterpret_cast<char*>(&h), sizeof h) ||
+        std::memcmp(h.magic, magic, sizeof h.magic) != 0) {
+      fail("not a snapshot");
+    }
+    if (h.version != version) fail("unsupported version");
+    if (h.byte_order != grid_file::byte_order) fail("wrong byte order");
+    // a corrupt header must not allocate beyond what a snapshot can hold
+    const double nb = double(h.n_bins);
+    const double cells = double(h.dimension) * nb + double(h.n_pairs) * nb * nb;
+    const double bytes = cells * sizeof(double) +
+                         double(h.n_pairs) * 2 * sizeof(std::uint32_t);
+    if (bytes > double(max_payload)) {
+      fail("snapshot too large");
+    }
+    Snapshot s;
+    s.dimension = h.dimension;
+    s.n_bins = h.n_bins;
+    s.density = h.density;
+    s.sums.sum = h.sum;
+    s.sums.sum2 = h.sum2;
+    s.sums.sum_abs = h.sum_abs;
+    s.sums.max_abs = h.max_abs;
+    s.sums.n = h.n;
+    s.pairs.resize(h.n_pairs);
+    for (auto& pr : s.pairs) {
+      std::uint32_t p[2];
+      in.read(reinterpret_cast<char*>(p), sizeof p);
+      pr = {p[0], p[1]};
+    }
+    s.one.resize(std::size_t(h.dimension) * h.n_bins);
+    s.pair.resize(std::size_t(h.n_pairs) * h.n_bins * h.n_bins);
+    in.read(reinterpret_cast<char*>(s.one.data()),
+            std::streamsize(s.one.size() * sizeof(double)));
+    in.read(reinterpret_cast<char*>(s.pair.data()),
+            std::streamsize(s.pair.size() * sizeof(double)));
+    s.weights.read(in);
+    if (!in) fail("truncated snapshot");
+    return s;
+  }
+
+  /// throws `std::system_error` if the file cannot be written
+  void save(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (out) write(out);
+    if (!out.flush()) {
+      throw std::system_error(errno, std::generic_category(),
+                              "kakuhen::Snapshot::save: " + path);
+    }
+  }
+
+  /// throws `std::system_error` if the file cannot be opened
+  static Snapshot load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      throw std::system_error(errno, std::generic_category(),
+                              "kakuhen::Snapshot::load: " + path);
+    }
+    return read(in);
+  }
+
+ private:
+  static constexpr char magic[8] = {'K', 'A', 'K', 'U', 'S', 'N', 'A', 'P'};
+  static constexpr std::uint32_t version = 3;
+  /// bound on the pairs and histograms of a snapshot in bytes
+  static constexpr std::uint64_t max_payload = std::uint64_t(1) << 40;
+
+  struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t dimension;
+    std::uint32_t n_bins;
+    std::uint32_t n_pairs;
+    std::uint32_t reserved;
+    std::uint64_t density;
+    double sum;
+    double sum2;
+    double sum_abs;
+    double max_abs;
+    std::uint64_t n;
+  };
+
+  [[noreturn]] static void fail(const char* what) {
+    throw std::runtime_error(std::string("kakuhen::Snapshot: ") + what);
+  }
+};
+
+}  // namespace kakuhen
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "kakuhen/rng.hpp"
+
+namespace kakuhen {
+
+/// Direction numbers of the Sobol sequence in base 2 with 32-bit
+/// resolution.  Dimension 0 is the van der Corput sequence; dimension
+/// `j > 0` takes the `j`-th primitive polynomial over GF(2) in order of
+/// degree and coefficients (x + 1, x^2 + x + 1, x^3 + x + 1, ...), so any
+/// number of dimensions is available.  The initial direction numbers m_k
+/// (odd, below 2^k) come from a fixed hash: every such choice makes the
+/// sequence a digital (t, s)-sequence, and the scrambling of `SobolStream`
+/// randomises the rest.
+class SobolSequence {
+ public:
+  static constexpr unsigned bits = 32;
+
+  SobolSequence() = default;
+
+  explicit SobolSequence(std::size_t dim) : dim_(dim), v_(bits * dim) {
+    if (dim == 0) return;
+    for (unsigned k = 0; k < bits; ++k) v_[k * dim] = 1u << (bits - 1 - k);
+    std::uint32_t degree = 1, a = 0;
+    std::uint32_t m[bits + 1];
+    for (std::size_t j = 1; j < dim; ++j) {
+      // next primitive polynomial x^s + a_1 x^(s-1) + ... + a_(s-1) x + 1
+      while (!primitive(degree, a)) {
+        if (++a == 1u << (degree - 1)) {
+          ++degree;
+          a = 0;
+        }
+      }
+      const unsigned s = degree;
+      for (unsigned k = 1; k <= s; ++k) {
+        const std::uint64_t h = mix64(std::uint64_t(j) << 8 | k);
+        m[k] = (std::uint32_t(h) & ((1u << k) - 1)) | 1u;
+      }
+      // V_k = m_k 2^(32 - k), continued by the recurrence of the polynomial
+      std::uint32_t v[bits + 1];
+      for (unsigned k = 1; k <= s && k <= bits; ++k) v[k] = m[k] << (bits - k);
+      for (unsigned k = s + 1; k <= bits; ++k) {
+        v[k] = v[k - s] ^ (v[k - s] >> s);
+        for (unsigned l = 1; l < s; ++l) {
+          if ((a >> (s - 1 - l)) & 1u) v[k] ^= v[k - l];
+        }
+      }
+      for (unsigned k = 0; k < bits; ++k) v_[k * dim + j] = v[k + 1];
+      if (++a == 1u << (degree - 1)) {
+        ++degree;
+        a = 0;
+      }
+    }
+  }
+
+  std::size_t dimension() const noexcept { return dim_; }
+
+  /// direction numbers of bit `k` of all dimensions
+  const std::uint32_t* direction(unsigned k) const noexcept {
+    return v_.data() + k * dim_;
+  }
+
+  /// Point `k` in Gray-code order, i.e. the XOR of the direction numbers
+  /// of the bits of k ^ (k >> 1), in `x[0, dimension())`.  Consecutive
+  /// points differ by the direction numbers of one bit, and the first 2^m
+  /// points are those of the sequence in natural order.
+  void point(std::uint64_t k, std::uint32_t* x) const noexcept {
+    for (std::size_t d = 0; d < dim_; ++d) x[d] = 0;
+    const std::uint64_t g = k ^ (k >> 1);
+    for (unsigned b = 0; b < bits; ++b) {
+      if (!((g >> b) & 1u)) continue;
+      const std::uint32_t* v = direction(b);
+      for (std::size_t d = 0; d < dim_; ++d) x[d] ^= v[d];
+    }
+  }
+
+ private:
+  /// whether the polynomial of degree `s` with the inner coefficients `a`
+  /// is primitive: x has the order 2^s - 1 modulo it
+  static bool primitive(unsigned s, std::uint32_t a) noexcept {
+    const std::uint64_t p = (std::uint64_t(1) << s) | (std::uint64_t(a) << 1) |
+                            1u;
+    const std::uint64_t order = (std::uint64_t(1) << s) - 1;
+    const auto power = [p, s](std::uint64_t e) {
+      std::uint64_t r = 1, b = s > 1 ? 2 : 1;
+      for (; e > 0; e >>= 1) {
+        if (e & 1u) r = multiply(r, b, p, s);
+        b = multiply(b, b, p, s);
+      }
+      return r;
+    };
+    if (power(order) != 1) return false;
+    // no proper divisor order / q, q a prime factor, is the order
+    std::uint64_t rest = order;
+    for (std::uint64_t q = 2; q * q <= rest; ++q) {
+      if (rest % q != 0) continue;
+      if (power(order / q) == 1) return false;
+      while (rest % q == 0) rest /= q;
+    }
+    return rest == 1 || power(order / rest) != 1;
+  }
+
+  /// product of two polynomials modulo `p` of degree `s`
+  static std::uint64_t multiply(std::uint64_t a, std::uint64_t b,
+                                std::uint64_t p, unsigned s) noexcept {
+    std::uint64_t r = 0;
+    for (; b > 0; b >>= 1) {
+      if (b & 1u) r ^= a;
+      a <<= 1;
+      if ((a >> s) & 1u) a ^= p;
+    }
+    return r;
+  }
+
+  std::size_t dim_ = 0;
+  /// [bit][dimension]
+  std::vector<std::uint32_t> v_;
+};
+
+/// Randomised Sobol points of one chunk of an iteration.  The points of an
+/// iteration are interleaved from `n_random` independent randomisations of
+/// the sequence (point p is point p / n_random of randomisation
+/// p % n_random), so every chunk and every prefix of the iteration holds
+/// about equal numbers of each.  A randomisation scrambles every
+/// coordinate with a nested (Owen-type) permutation of its bits, the
+/// hash-based one of Laine and Karras in the form of Burley: bit i is
+/// flipped depending on the bits above it only, which keeps the net
+/// structure of the sequence, and the addition of a uniform random key
+/// makes every point uniform on the 2^-32 grid, so that each randomisation
+/// gives an unbiased estimate and their spread its error.  The keys
+/// derive from (seed, iteration, randomisation, dimension).
+class SobolStream {
+ public:
+  SobolStream() = default;
+
+  SobolStream(std::size_t dim, std::size_t n_random)
+      : dim_(dim),
+        n_random_(n_random),
+        x_(dim * n_random),
+        key_(dim * n_random),
+        index_(n_random) {}
+
+  /// position the stream at point `first` of iteration `iteration`
+  void reset(const SobolSequence& seq, std::uint64_t seed,
+             std::uint64_t iteration, std::uint64_t first) noexcept {
+    seq_ = &seq;
+    next_ = std::size_t(first % n_random_);
+    for (std::size_t r = 0; r < n_random_; ++r) {
+      const std::uint64_t ahead = (r + n_random_ - next_) % n_random_;
+      index_[r] = (first + ahead) / n_random_;
+      seq.point(index_[r], x_.data() + r * dim_);
+      for (std::size_t d = 0; d < dim_; ++d) {
+        key_[r * dim_ + d] =
+            std::uint32_t(stream_seed(seed, iteration, r * dim_ + d));
+      }
+    }
+  }
+
+  /// Write the next `n` points to `u[d * stride + i]` (coordinate `d` of
+  /// point `i`) and their randomisations to `group[i]`.
+  template <typename Float>
+  void fill(Float* u, std::size_t stride, std::size_t n,
+            std::uint32_t* group) noexcept {
+    const std::size_t dim = dim_;
+    for (std::size_t i = 0; i < n; ++i) {
+      const std::size_t r = next_;
+      std::uint32_t* x = x_.data() + r * dim;
+      const std::uint32_t* key = key_.data() + r * dim;
+      for (std::size_t d = 0; d < dim; ++d) {
+        const std::uint32_t y = scramble(x[d], key[d]);
+        u[d * stride + i] = Xoshiro256pp::to_uniform<Float>(std::uint64_t(y)
+                                                            << 32);
+      }
+      group[i] = std::uint32_t(r);
+      // Gray code: the next point differs by the direction numbers of the
+      // lowest set bit of its index
+      const std::uint32_t* v = seq_->direction(lowest_bit(++index_[r]));
+      for (std::size_t d = 0; d < dim; ++d) x[d] ^= v[d];
+      next_ = r + 1 == n_random_ ? 0 : r + 1;
+    }
+  }
+
+  /// nested scramble of the bits of `x` keyed by `key`
+  static std::uint32_t scramble(std::uint32_t x, std::uint32_t key) noexcept {
+    x = reverse_bits(x);
+    // every step changes bit i depending on the bits below it only
+    x += key;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+  }
+
+ private:
+  /// index of the lowest set bit of `k > 0` (below 2^32)
+  static unsigned lowest_bit(std::uint64_t k) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    return unsigned(__builtin_ctzll(k));
+#else
+    unsigned b = 0;
+    while (!((k >> b) & 1u)) ++b;
+    return b;
+#endif
+  }
+
+  const SobolSequence* seq_ = nullptr;
+  std::size_t dim_ = 0;
+  std::size_t n_random_ = 0;
+  /// current point and scrambling keys of every randomisation
+  /// ([randomisation][dimension]), and the index of its current point
+  std::vector<std::uint32_t> x_;
+  std::vector<std::uint32_t> key_;
+  std::vector<std::uint64_t> index_;
+  /// randomisation of the next point
+  std::size_t next_ = 0;
+};
+
+}  // namespace kakuhen
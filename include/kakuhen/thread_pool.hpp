@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace kakuhen {
+
+/// Fixed set of worker threads that execute one job at a time.
+///
+/// `run(job)` calls `job(i)` once for every worker index `i` in
+/// `[0, size())` and returns once all calls have finished.  The calling
+/// thread takes part as worker 0, so a pool of size 1 spawns no threads.
+/// The job is referenced through a plain function pointer, so `run` does
+/// not allocate.
+class ThreadPool {
+ public:
+  explicit ThreadPool(std::size_t n_threads) {
+    if (n_threads == 0) {
+      n_threads = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    threads_.reserve(n_threads - 1);
+    for (std::size_t i = 1; i < n_threads; ++i) {
+      threads_.emplace_back([this, i] { loop(i); });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& t : threads_) t.join();
+  }
+
+  std::size_t size() const noexcept { return threads_.size() + 1; }
+
+  /// Execute `job(i)` for all workers and wait for completion.  An exception
+  /// thrown by any of the calls is rethrown here (the first one wins).
+  template <typename Job>
+  void run(Job&& job) {
+    using job_type = std::remove_reference_t<Job>;
+    if (threads_.empty()) {
+      job(std::size_t(0));
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_ = const_cast<void*>(static_cast<const void*>(&job));
+      invoke_ = [](void* j, std::size_t i) { (*static_cast<job_type*>(j))(i); };
+      pending_ = threads_.size();
+      error_ = nullptr;
+      ++generation_;
+    }
+    start_.notify_all();
+    execute(0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+    if (error_) std::rethrow_exception(error_);
+  }
+
+ private:
+  void execute(std::size_t i) noexcept {
+    try {
+      invoke_(job_, i);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) error_ = std::current_exception();
+    }
+  }
+
+  void loop(std::size_t i) {
+    std::uint64_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) return;
+        seen = generation_;
+      }
+      execute(i);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0) done_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  void* job_ = nullptr;
+  void (*invoke_)(void*, std::size_t) = nullptr;
+  std::size_t pending_ = 0;
+  std::uint64_t generation_ = 0;
+  bool stop_ = false;
+  std::exception_ptr error_;
+};
+
+/// Meeting point of the workers of a `ThreadPool::run` job, to run an
+/// action while none of them is inside a unit of work.
+///
+/// After `request()` every worker still at work calls `arrive` between two
+/// units, and the last one to arrive runs the action while the others
+/// wait.  A worker that runs out of work leaves (through `Seat`), so that
+/// the others do not wait for it.  A worker that leaves by an exception may
+/// have stopped inside a unit, so the action is not run any more.
+class Rendezvous {
+ public:
+  explicit Rendezvous(std::size_t n_workers) noexcept : active_(n_workers) {}
+
+  /// membership of one worker, which leaves at the end of its scope, also
+  /// if it throws
+  template <typename Action>
+  class Seat {
+   public:
+    Seat(Rendezvous& r, Action& action) noexcept
+        : r_(r), action_(action), exceptions_(std::uncaught_exceptions()) {}
+    Seat(const Seat&) = delete;
+    Seat& operator=(const Seat&) = delete;
+    ~Seat() { r_.leave(action_, std::uncaught_exceptions() > exceptions_); }
+
+   private:
+    Rendezvous& r_;
+    Action& action_;
+    int exceptions_;
+  };
+
+  void request() noexcept { requested_.store(true, std::memory_order_relaxed); }
+  bool requested() const noexcept {
+    return requested_.load(std::memory_order_relaxed);
+  }
+
+  /// wait until all workers at work have arrived; the last one runs
+  /// `action()`, which must not throw
+  template <typename Action>
+  void arrive(Action& action) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (++arrived_ == active_) {
+      release(action);
+      return;
+    }
+    const std::uint64_t generation = generation_;
+    met_.wait(lock, [&] { return generation_ != generation; });
+  }
+
+ private:
+  template <typename Action>
+  void leave(Action& action, bool failed) noexcept {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --active_;
+    broken_ = broken_ || failed;
+    if (requested() && arrived_ == active_) release(action);
+  }
+
+  template <typename Action>
+  void release(Action& action) noexcept {
+    if (!broken_) action();
+    arrived_ = 0;
+    requested_.store(false, std::memory_order_relaxed);
+    ++generation_;
+    met_.notify_all();
+  }
+
+  std::mutex mutex_;
+  std::condition_variable met_;
+  std::atomic<bool> requested_{false};
+  std::size_t active_;
+  std::size_t arrived_ = 0;
+  std::uint64_t generation_ = 0;
+  bool broken_ = false;
+};
+
+}  // namespace kakuhen
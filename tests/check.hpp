@@ -0,0 +1,36 @@
+#pragma once
+
+// Minimal test harness: KAKUHEN_CHECK records a failed condition and the
+// test's main returns `kakuhen_test::report()`, non-zero on any failure.
+
+#include <cstdio>
+#include <cstring>
+
+namespace kakuhen_test {
+
+inline int& failures() {
+  static int n = 0;
+  return n;
+}
+
+inline void check(bool ok, const char* what, const char* file, int line) {
+  if (ok) return;
+  ++failures();
+  std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+}
+
+/// the object representations of `a` and `b` are equal
+template <typename T>
+bool same_bytes(const T& a, const T& b) {
+  return std::memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+inline int report() {
+  if (failures() > 0) std::fprintf(stderr, "%d check(s) failed\n", failures());
+  return failures() > 0 ? 1 : 0;
+}
+
+}  // namespace kakuhen_test
+
+#define KAKUHEN_CHECK(cond) \
+  ::kakuhen_test::check(bool(cond), #cond, __FILE__, __LINE__)
@@ -0,0 +1,263 @@
+// A run killed in the middle of an iteration and resumed from its last
+// periodic checkpoint ends bit-identical to an uninterrupted run, with
+// `integrate` and with `run`, and a checkpoint taken with other options,
+// with parents or histogram cells outside its pairs, or whose chunks or
+// strata do not fit the options is rejected, as is a file whose header claims more
+// payload than it holds.
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "check.hpp"
+#include "kakuhen/kakuhen.hpp"
+
+namespace {
+
+constexpr std::size_t dim = 4;
+constexpr std::size_t n_iterations = 6;
+constexpr std::uint64_t n_samples = 30000;
+
+/// integrand calls left before the process is "killed" (negative: never)
+std::atomic<long> calls_left{-1};
+
+struct Killed {};
+
+double integrand(const std::array<double, dim>& x) {
+  if (calls_left.load() >= 0 && calls_left.fetch_sub(1) == 0) throw Killed{};
+  const double a = (x[0] - x[1]) / 0.1, b = (x[2] - 0.3) / 0.2;
+  return std::exp(-0.5 * (a * a + b * b)) * (1. + x[3]);
+}
+
+struct Run {
+  kakuhen::Result result;
+  std::string grid;
+};
+
+Run finish(kakuhen::Integrator<dim>& integrator) {
+  std::ostringstream grid(std::ios::binary);
+  integrator.save_grid(grid);
+  return {integrator.result(), grid.str()};
+}
+
+bool identical(const Run& a, const Run& b) {
+  const double va[] = {a.result.value(), a.result.error(),
+                       a.result.chi2dof()};
+  const double vb[] = {b.result.value(), b.result.error(),
+                       b.result.chi2dof()};
+  return kakuhen_test::same_bytes(va, vb) &&
+         a.result.n_samples() == b.result.n_samples() && a.grid == b.grid;
+}
+
+/// `resume(c)` throws `Error`
+template <typename Error = std::runtime_error>
+bool rejects(kakuhen::Integrator<dim>& integrator,
+             const kakuhen::Checkpoint& c) {
+  try {
+    integrator.resume(c);
+  } catch (const Error&) {
+    return true;
+  }
+  return false;
+}
+
+void check_resume(const char* name, kakuhen::Options opts) {
+  std::fprintf(stderr, "%s\n", name);
+  opts.n_threads = 4;
+  calls_left = -1;
+  kakuhen::Integrator<dim> reference(opts);
+  reference.integrate(integrand, n_iterations, n_samples);
+  const Run whole = finish(reference);
+
+  // killed halfway through the fourth iteration (after the pilot chunk)
+  const std::string path = std::string("checkpoint_") + name + ".ckpt";
+  std::remove(path.c_str());
+  opts.checkpoint_path = path;
+  opts.checkpoint_interval = 0.;
+  {
+    kakuhen::Integrator<dim> killed(opts);
+    calls_left = long(opts.chunk_size + 3 * n_samples + n_samples / 2);
+    bool thrown = false;
+    try {
+      killed.integrate(integrand, n_iterations, n_samples);
+    } catch (const Killed&) {
+      thrown = true;
+    }
+    KAKUHEN_CHECK(thrown);
+    killed.flush_checkpoint();
+  }
+  calls_left = -1;
+
+  // the periodic checkpoints are taken between chunks; one that finds the
+  // previous still being written is skipped, so the last may be older
+  const kakuhen::Checkpoint c = kakuhen::Checkpoint::load(path);
+  KAKUHEN_CHECK(c.n_samples == n_samples);
+  KAKUHEN_CHECK(c.result.n_iterations() <= 3);
+  kakuhen::Integrator<dim> resumed(opts);
+  resumed.resume(c);
+  resumed.integrate(integrand, n_iterations - c.result.n_iterations(),
+                    n_samples);
+  KAKUHEN_CHECK(identical(whole, finish(resumed)));
+  resumed.flush_checkpoint();
+  std::remove(path.c_str());
+
+  kakuhen::Integrator<dim> other(opts);
+  kakuhen::Checkpoint bad = c;
+  bad.done.pop_back();
+  KAKUHEN_CHECK(rejects(other, bad));
+  bad = c;
+  bad.chunk_sums.emplace_back();
+  KAKUHEN_CHECK(rejects(other, bad));
+  bad = c;
+  bad.chunk_mix.push_back(0.);
+  KAKUHEN_CHECK(rejects(other, bad));
+  bad = c;
+  bad.cube_partials.emplace_back();
+  KAKUHEN_CHECK(rejects(other, bad));
+  bad = c;
+  bad.strata_var.push_back(0.);
+  KAKUHEN_CHECK(rejects(other, bad));
+  bad = c;
+  bad.n_samples += opts.chunk_size;
+  KAKUHEN_CHECK(rejects(other, bad));
+
+  using kakuhen::Structure;
+  bad = c;
+  bad.structure = std::uint32_t(opts.structure == Structure::none
+                                    ? Structure::chain
+                                    : Structure::none);
+  KAKUHEN_CHECK(rejects<std::invalid_argument>(other, bad));
+  bad = c;
+  bad.defensive += 0.01;
+  KAKUHEN_CHECK(rejects<std::invalid_argument>(other, bad));
+  bad = c;
+  bad.defensive_adapt = !bad.defensive_adapt;
+  KAKUHEN_CHECK(rejects<std::invalid_argument>(other, bad));
+  bad = c;
+  bad.sparse_pairs = !bad.sparse_pairs;
+  KAKUHEN_CHECK(rejects<std::invalid_argument>(other, bad));
+  bad = c;
+  bad.parents[1] = 1;
+  KAKUHEN_CHECK(rejects<std::invalid_argument>(other, bad));
+  bad = c;
+  bad.parents[1] = dim;
+  KAKUHEN_CHECK(rejects<std::invalid_argument>(other, bad));
+  // a parent whose pair is not stored
+  for (std::uint32_t j = 1; j < dim; ++j) {
+    bool stored = false;
+    for (std::size_t k = 0; k + 1 < c.pairs.size(); k += 2) {
+      stored = stored || (c.pairs[k] == 0 && c.pairs[k + 1] == j);
+    }
+    if (stored) continue;
+    bad = c;
+    bad.parents[j] = 0;
+    KAKUHEN_CHECK(rejects<std::invalid_argument>(other, bad));
+    break;
+  }
+  bad = c;
+  bad.pair_cells.push_back(std::uint32_t(c.tables.size()));
+  bad.pair_counts.push_back(1);
+  KAKUHEN_CHECK(rejects<std::invalid_argument>(other, bad));
+}
+
+/// `run` keeps the refinement data of the chunks beyond the finished
+/// prefix apart; a checkpoint has them run again after the resume.
+void check_run_resume() {
+  std::fprintf(stderr, "run\n");
+  kakuhen::Options opts;
+  opts.seed = 7;
+  opts.n_threads = 4;
+  kakuhen::RunControl control;
+  control.max_iterations = n_iterations;
+  control.n_samples = n_samples;
+  calls_left = -1;
+  kakuhen::Integrator<dim> reference(opts);
+  reference.run(integrand, control);
+  const Run whole = finish(reference);
+
+  const std::string path = "checkpoint_run.ckpt";
+  std::remove(path.c_str());
+  opts.checkpoint_path = path;
+  opts.checkpoint_interval = 0.;
+  {
+    kakuhen::Integrator<dim> killed(opts);
+    calls_left = long(opts.chunk_size + 3 * n_samples + n_samples / 2);
+    try {
+      killed.run(integrand, control);
+    } catch (const Killed&) {
+    }
+    killed.flush_checkpoint();
+  }
+  calls_left = -1;
+
+  kakuhen::Integrator<dim> resumed(opts);
+  resumed.load_checkpoint(path);
+  resumed.run(integrand, control);
+  KAKUHEN_CHECK(identical(whole, finish(resumed)));
+  resumed.flush_checkpoint();
+  std::remove(path.c_str());
+}
+
+/// `read` of the checkpoint `c` with the header field payload_size
+/// replaced by `size` throws `std::runtime_error`
+bool rejects_payload(const kakuhen::Checkpoint& c, std::uint64_t size) {
+  std::ostringstream out(std::ios::binary);
+  c.write(out);
+  std::string b = out.str();
+  // magic, version and byte order precede payload_size
+  std::memcpy(&b[16], &size, sizeof size);
+  std::istringstream in(b, std::ios::binary);
+  try {
+    kakuhen::Checkpoint::read(in);
+  } catch (const std::runtime_error&) {
+    return true;
+  }
+  return false;
+}
+
+void check_payload_size() {
+  kakuhen::Options opts;
+  opts.seed = 7;
+  kakuhen::Integrator<dim> integrator(opts);
+  integrator.integrate(integrand, 1, 5000);
+  const kakuhen::Checkpoint c = integrator.checkpoint();
+  std::ostringstream out(std::ios::binary);
+  c.write(out);
+  const std::uint64_t size = out.str().size() - 32;
+  KAKUHEN_CHECK(!rejects_payload(c, size));
+  KAKUHEN_CHECK(rejects_payload(c, ~std::uint64_t(0)));
+  KAKUHEN_CHECK(rejects_payload(c, std::uint64_t(1) << 39));
+  KAKUHEN_CHECK(rejects_payload(c, size + 1));
+}
+
+}  // namespace
+
+int main() {
+  kakuhen::Options opts;
+  opts.seed = 7;
+  check_resume("none", opts);
+
+  kakuhen::Options tree = opts;
+  tree.structure = kakuhen::Structure::tree;
+  tree.defensive = 0.05;
+  tree.defensive_adapt = true;
+  check_resume("tree", tree);
+
+  kakuhen::Options stratify = opts;
+  stratify.stratify = true;
+  check_resume("stratify", stratify);
+
+  kakuhen::Options sobol = tree;
+  sobol.sampling = kakuhen::Sampling::sobol;
+  sobol.randomizations = 8;
+  check_resume("sobol", sobol);
+  check_run_resume();
+  check_payload_size();
+  return kakuhen_test::report();
+}
@@ -0,0 +1,145 @@
+// MultiChannel: every channel contributes its term even with the fewest
+// points an iteration allows, the pilot run happens once, and the results
+// do not depend on the number of threads.
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+
+#include "check.hpp"
+#include "kakuhen/kakuhen.hpp"
+
+namespace {
+
+constexpr std::size_t dim = 2;
+using point = std::array<double, dim>;
+
+struct Resonance {
+  std::size_t var;
+  double mass, width;
+
+  double operator()(double x) const {
+    const double t = x - mass;
+    return width / (t * t + width * width);
+  }
+  double lo() const { return std::atan(-mass / width); }
+  double hi() const { return std::atan((1. - mass) / width); }
+};
+
+const Resonance peaks[3] = {{0, 0.3, 0.05}, {1, 0.6, 0.08}, {0, 0.8, 0.1}};
+
+/// channel i: Cauchy map in the variable of peak i
+struct Mappings {
+  std::size_t size() const { return 3; }
+
+  double map(std::size_t i, const point& y, point& x) const {
+    const Resonance& r = peaks[i];
+    x = y;
+    const double range = r.hi() - r.lo();
+    x[r.var] = r.mass + r.width * std::tan(r.lo() + y[r.var] * range);
+    return range / r(x[r.var]);
+  }
+  double inverse(std::size_t i, const point& x, point& y) const {
+    const Resonance& r = peaks[i];
+    y = x;
+    const double range = r.hi() - r.lo();
+    y[r.var] = (std::atan((x[r.var] - r.mass) / r.width) - r.lo()) / range;
+    return r(x[r.var]) / range;
+  }
+};
+
+double integrand(const point& x) {
+  return peaks[0](x[0]) + peaks[1](x[1]) + peaks[2](x[0]);
+}
+
+double exact() {
+  double sum = 0.;
+  for (const Resonance& r : peaks) sum += r.hi() - r.lo();
+  return sum;
+}
+
+using Multi = kakuhen::MultiChannel<dim, Mappings>;
+
+kakuhen::Options options(std::size_t n_threads) {
+  kakuhen::Options opts;
+  opts.structure = kakuhen::Structure::none;
+  opts.n_threads = n_threads;
+  opts.seed = 3;
+  return opts;
+}
+
+void check_too_few_points() {
+  Multi multi(Mappings{}, options(1));
+  bool thrown = false;
+  try {
+    multi.iterate(integrand, 2 * multi.n_channels() - 1);
+  } catch (const std::invalid_argument&) {
+    thrown = true;
+  }
+  KAKUHEN_CHECK(thrown);
+}
+
+/// Iterations of the fewest points allowed, two per channel, must average
+/// to the integral: no channel may be starved by the rounding of its
+/// share.
+void check_least_points() {
+  Multi multi(Mappings{}, options(1));
+  multi.integrate(integrand, 5, 3000);
+  const std::size_t n_iter = 20000;
+  double sum = 0., sum2 = 0.;
+  for (std::size_t it = 0; it < n_iter; ++it) {
+    const double v =
+        multi.iterate(integrand, 2 * multi.n_channels(), false).value;
+    sum += v;
+    sum2 += v * v;
+  }
+  const double mean = sum / double(n_iter);
+  const double err =
+      std::sqrt((sum2 / double(n_iter) - mean * mean) / double(n_iter - 1));
+  std::fprintf(stderr, "least points: %.6f +- %.6f, exact %.6f\n", mean, err,
+               exact());
+  KAKUHEN_CHECK(std::abs(mean - exact()) < 5. * err);
+}
+
+/// Only the first iteration evaluates the pilot chunk; later ones, which
+/// keep filling the same histograms, leave their unit alone.
+void check_single_pilot() {
+  std::atomic<std::uint64_t> calls{0};
+  const auto counted = [&calls](const point& x) {
+    ++calls;
+    return integrand(x);
+  };
+  const kakuhen::Options opts = options(2);
+  Multi multi(Mappings{}, opts);
+  const std::uint64_t n = 10000;
+  multi.iterate(counted, n, false);
+  KAKUHEN_CHECK(calls > n && calls <= n + opts.chunk_size);
+  for (int it = 0; it < 3; ++it) {
+    calls = 0;
+    multi.iterate(counted, n, false);
+    KAKUHEN_CHECK(calls == n);
+  }
+}
+
+void check_threads() {
+  Multi one(Mappings{}, options(1)), four(Mappings{}, options(4));
+  const kakuhen::Result& a = one.integrate(integrand, 5, 20000);
+  const kakuhen::Result& b = four.integrate(integrand, 5, 20000);
+  KAKUHEN_CHECK(a.value() == b.value() && a.error() == b.error());
+  for (std::size_t i = 0; i < one.n_channels(); ++i) {
+    KAKUHEN_CHECK(one.alpha(i) == four.alpha(i));
+  }
+}
+
+}  // namespace
+
+int main() {
+  check_too_few_points();
+  check_least_points();
+  check_single_pilot();
+  check_threads();
+  return kakuhen_test::report();
+}
@@ -0,0 +1,106 @@
+// Philox4x32-10 against the known-answer vectors of Random123
+// (kat_vectors), and the vector paths of `PhiloxStream` against the scalar
+// path.
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "check.hpp"
+#include "kakuhen/philox.hpp"
+
+namespace {
+
+using kakuhen::Philox4x32;
+
+void check_known_answers() {
+  struct Vector {
+    Philox4x32::counter_type counter;
+    Philox4x32::key_type key;
+    Philox4x32::counter_type expected;
+  };
+  static const Vector vectors[] = {
+      {{0x00000000u, 0x00000000u, 0x00000000u, 0x00000000u},
+       {0x00000000u, 0x00000000u},
+       {0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u}},
+      {{0xffffffffu, 0xffffffffu, 0xffffffffu, 0xffffffffu},
+       {0xffffffffu, 0xffffffffu},
+       {0x408f276du, 0x41c83b0eu, 0xa20bc7c6u, 0x6d5451fdu}},
+      {{0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0x03707344u},
+       {0xa4093822u, 0x299f31d0u},
+       {0xd16cfe09u, 0x94fdccebu, 0x5001e420u, 0x24126ea1u}},
+  };
+  for (const Vector& v : vectors) {
+    KAKUHEN_CHECK(Philox4x32::apply(v.counter, v.key) == v.expected);
+  }
+  // the generator is usable in constant expressions
+  static_assert(Philox4x32::apply({0, 0, 0, 0}, {0, 0})[0] == 0x6627e8d5u);
+}
+
+/// `fill_uniform` of a stream at the current level, for lengths that end
+/// inside a group, at a position away from 0 and crossing 2^32
+template <typename Float>
+std::vector<Float> fill(std::uint64_t seed, std::uint64_t stream) {
+  std::vector<Float> out;
+  kakuhen::PhiloxStream rng(seed, stream);
+  rng.seek((std::uint64_t(1) << 32) - 40);
+  for (std::size_t n : {1, 7, 64, 1000, 3, 4096}) {
+    std::vector<Float> u(n);
+    rng.fill_uniform(u.data(), n);
+    out.insert(out.end(), u.begin(), u.end());
+  }
+  return out;
+}
+
+template <typename Float>
+void check_levels(const char* name) {
+  using kakuhen::simd::Level;
+  const std::uint64_t seed = 0x0123456789abcdefULL, stream = 0xfedcba98ULL;
+  kakuhen::simd::set_level(Level::scalar);
+  const std::vector<Float> reference = fill<Float>(seed, stream);
+
+  // the first group of the scalar path is the Philox output of counters
+  // (pos, stream) in the documented layout
+  kakuhen::PhiloxStream rng(seed, stream);
+  Float first[kakuhen::philox::per_group<Float>];
+  rng.fill_uniform(first, kakuhen::philox::per_group<Float>);
+  const auto c = Philox4x32::apply(
+      {0, 0, std::uint32_t(stream), std::uint32_t(stream >> 32)},
+      {std::uint32_t(seed), std::uint32_t(seed >> 32)});
+  if constexpr (sizeof(Float) <= sizeof(float)) {
+    KAKUHEN_CHECK(first[0] == kakuhen::philox::to_float(c[0]));
+    KAKUHEN_CHECK(first[kakuhen::philox::group] ==
+                  kakuhen::philox::to_float(c[1]));
+  } else {
+    KAKUHEN_CHECK(first[0] ==
+                  kakuhen::philox::to_double(std::uint64_t(c[1]) << 32 | c[0]));
+    KAKUHEN_CHECK(first[kakuhen::philox::group] ==
+                  kakuhen::philox::to_double(std::uint64_t(c[3]) << 32 | c[2]));
+  }
+
+  for (Level lvl : {Level::avx2, Level::avx512}) {
+    if (kakuhen::simd::detect() < lvl) {
+      std::fprintf(stderr, "%s: level %d not supported, skipped\n", name,
+                   int(lvl));
+      continue;
+    }
+    kakuhen::simd::set_level(lvl);
+    const std::vector<Float> out = fill<Float>(seed, stream);
+    KAKUHEN_CHECK(out.size() == reference.size());
+    bool same = out.size() == reference.size();
+    for (std::size_t i = 0; same && i < out.size(); ++i) {
+      same = kakuhen_test::same_bytes(out[i], reference[i]);
+    }
+    KAKUHEN_CHECK(same);
+  }
+  kakuhen::simd::set_level(kakuhen::simd::detect());
+}
+
+}  // namespace
+
+int main() {
+  check_known_answers();
+  check_levels<double>("double");
+  check_levels<float>("float");
+  return kakuhen_test::report();
+}
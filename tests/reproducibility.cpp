@@ -0,0 +1,99 @@
+// Results, grids and refinement data must be bit-identical for any number
+// of threads (chunk-labelled random streams, fixed-point histograms and
+// reductions in chunk order) and reproducible from the seed.
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+#include "check.hpp"
+#include "kakuhen/kakuhen.hpp"
+
+namespace {
+
+constexpr std::size_t dim = 4;
+
+double integrand(const std::array<double, dim>& x) {
+  const double a = (x[0] - x[1]) / 0.1, b = (x[2] - 0.3) / 0.2;
+  return std::exp(-0.5 * (a * a + b * b)) * (1. + x[3]);
+}
+
+struct Run {
+  kakuhen::Result result;
+  std::string grid;
+};
+
+Run run(kakuhen::Options opts, std::size_t n_threads) {
+  opts.n_threads = n_threads;
+  kakuhen::Integrator<dim> integrator(opts);
+  integrator.integrate(integrand, 5, 20000);
+  std::ostringstream grid(std::ios::binary);
+  integrator.save_grid(grid);
+  return {integrator.result(), grid.str()};
+}
+
+bool identical(const Run& a, const Run& b) {
+  const double va[] = {a.result.value(), a.result.error(),
+                       a.result.chi2dof()};
+  const double vb[] = {b.result.value(), b.result.error(),
+                       b.result.chi2dof()};
+  return kakuhen_test::same_bytes(va, vb) &&
+         a.result.n_samples() == b.result.n_samples() && a.grid == b.grid;
+}
+
+void check_options(const char* name, const kakuhen::Options& opts) {
+  std::fprintf(stderr, "%s\n", name);
+  const Run one = run(opts, 1);
+  KAKUHEN_CHECK(std::isfinite(one.result.value()) &&
+                one.result.error() > 0.);
+  KAKUHEN_CHECK(identical(one, run(opts, 1)));
+  KAKUHEN_CHECK(identical(one, run(opts, 3)));
+  KAKUHEN_CHECK(identical(one, run(opts, 4)));
+
+  kakuhen::Options other = opts;
+  other.seed = opts.seed + 1;
+  KAKUHEN_CHECK(run(other, 1).result.value() != one.result.value());
+}
+
+}  // namespace
+
+int main() {
+  kakuhen::Options opts;
+  opts.seed = 11;
+  opts.n_bins = 32;
+
+  opts.structure = kakuhen::Structure::none;
+  check_options("none", opts);
+  opts.structure = kakuhen::Structure::chain;
+  check_options("chain", opts);
+  opts.structure = kakuhen::Structure::tree;
+  check_options("tree", opts);
+
+  kakuhen::Options sparse = opts;
+  sparse.sparse_pairs = true;
+  sparse.accumulation = kakuhen::Accumulation::sort;
+  check_options("tree, sparse pairs sorted", sparse);
+
+  kakuhen::Options stratified = opts;
+  stratified.stratify = true;
+  check_options("tree, stratified", stratified);
+
+  kakuhen::Options defensive = opts;
+  defensive.defensive = 0.1;
+  defensive.defensive_adapt = true;
+  check_options("tree, defensive", defensive);
+
+  kakuhen::Options sobol = opts;
+  sobol.sampling = kakuhen::Sampling::sobol;
+  check_options("tree, sobol", sobol);
+
+  kakuhen::Options lattice = opts;
+  lattice.structure = kakuhen::Structure::none;
+  lattice.sampling = kakuhen::Sampling::lattice;
+  check_options("none, lattice", lattice);
+
+  return kakuhen_test::report();
+}
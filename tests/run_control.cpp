@@ -0,0 +1,101 @@
+// An iteration that `run` cuts short keeps the refinement data of its
+// committed prefix of chunks only: its histograms and weight sketch are
+// those of a complete iteration of the prefix's points, however many
+// chunks the other threads finished beyond it.
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "check.hpp"
+#include "kakuhen/kakuhen.hpp"
+
+namespace {
+
+constexpr std::size_t dim = 4;
+using Integrator = kakuhen::Integrator<dim>;
+
+double integrand(const Integrator::point_type& x) {
+  const double a = (x[0] - x[1]) / 0.1, b = (x[2] - 0.3) / 0.2;
+  return std::exp(-0.5 * (a * a + b * b)) * (1. + x[3]);
+}
+
+/// batch integrand that is slow on every thread but the calling one, so
+/// that the calling thread (worker 0) reaches a quarter of the iteration
+/// while the others are inside their first chunks
+struct Skewed {
+  std::thread::id fast;
+  bool slow = false;
+
+  void operator()(const Integrator::batch_type& batch, double* values) const {
+    if (slow && std::this_thread::get_id() != fast) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      values[i] = integrand(batch.point(i));
+    }
+  }
+};
+
+kakuhen::Options options() {
+  kakuhen::Options opts;
+  opts.n_threads = 4;
+  opts.seed = 11;
+  opts.batch_size = 64;
+  opts.weight_sketch = true;
+  return opts;
+}
+
+std::string bytes(const kakuhen::Snapshot& s) {
+  std::ostringstream out(std::ios::binary);
+  s.write(out);
+  return out.str();
+}
+
+std::string grid(const Integrator& integrator) {
+  std::ostringstream out(std::ios::binary);
+  integrator.save_grid(out);
+  return out.str();
+}
+
+void check_truncated_prefix() {
+  const kakuhen::Options opts = options();
+  const std::uint64_t n = 64 * opts.chunk_size;
+  Skewed f{std::this_thread::get_id()};
+
+  Integrator cut(opts);
+  cut.integrate_batch(f, 2, n);
+  kakuhen::RunControl control;
+  control.n_samples = n;
+  control.rel_error = 0.5;
+  f.slow = true;
+  const kakuhen::RunReport report = cut.run_batch(f, control);
+  f.slow = false;
+  KAKUHEN_CHECK(report.n_iterations == 1 && report.truncated);
+  KAKUHEN_CHECK(report.n_samples % opts.chunk_size == 0);
+  std::fprintf(stderr, "kept %llu of %llu points\n",
+               static_cast<unsigned long long>(report.n_samples),
+               static_cast<unsigned long long>(n));
+
+  // the same chunks as a complete, non-adapting iteration
+  Integrator whole(opts);
+  whole.integrate_batch(f, 2, n);
+  whole.iterate_batch(f, report.n_samples, false);
+
+  KAKUHEN_CHECK(bytes(cut.snapshot()) == bytes(whole.snapshot()));
+  cut.adapt();
+  whole.adapt();
+  KAKUHEN_CHECK(grid(cut) == grid(whole));
+}
+
+}  // namespace
+
+int main() {
+  check_truncated_prefix();
+  return kakuhen_test::report();
+}
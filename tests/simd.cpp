@@ -0,0 +1,95 @@
+// Every dispatch target of `simd::map_uniform` and `simd::map_bins` must
+// reproduce the scalar reference kernels bit for bit.
+
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+#include "check.hpp"
+#include "kakuhen/philox.hpp"
+#include "kakuhen/simd.hpp"
+
+namespace {
+
+namespace simd = kakuhen::simd;
+
+template <typename Float>
+bool same(const std::vector<Float>& a, const std::vector<Float>& b) {
+  if (a.size() != b.size()) return false;
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    if (!kakuhen_test::same_bytes(a[i], b[i])) return false;
+  }
+  return true;
+}
+
+template <typename Float>
+void check_kernels(const char* name) {
+  constexpr std::uint32_t nb = 37;
+  // uneven grid: edges from a non-linear map of [0, 1]
+  std::vector<Float> edges(nb + 1), widths(nb);
+  for (std::uint32_t b = 0; b <= nb; ++b) {
+    const double t = double(b) / nb;
+    edges[b] = Float(t * t * (3. - 2. * t));
+  }
+  for (std::uint32_t b = 0; b < nb; ++b) widths[b] = edges[b + 1] - edges[b];
+
+  // uniform numbers, with the extremes of [0, 1)
+  const std::size_t n = 1000;
+  std::vector<Float> u(n), frac(n), prob(n), w0(n);
+  std::vector<std::uint32_t> bins(n);
+  kakuhen::PhiloxStream rng(5, 0);
+  rng.fill_uniform(u.data(), n);
+  rng.fill_uniform(frac.data(), n);
+  u[0] = Float(0);
+  u[1] = Float(1) - std::numeric_limits<Float>::epsilon() / 2;
+  for (std::size_t i = 0; i < n; ++i) {
+    bins[i] = std::uint32_t(i * 7919 % nb);
+    prob[i] = Float(0.5 + u[i]) / Float(nb);
+    w0[i] = Float(1. + 0.001 * double(i));
+  }
+
+  for (std::size_t len : {std::size_t(1), std::size_t(3), std::size_t(8),
+                          std::size_t(17), n}) {
+    std::vector<Float> x_ref(len), w_ref(w0.begin(), w0.begin() + len);
+    std::vector<std::uint32_t> bin_ref(len);
+    simd::scalar::map_uniform(edges.data(), widths.data(), nb, u.data(), len,
+                              x_ref.data(), bin_ref.data(), w_ref.data());
+    std::vector<Float> xb_ref(len), wb_ref(w0.begin(), w0.begin() + len);
+    simd::scalar::map_bins(edges.data(), widths.data(), bins.data(),
+                           frac.data(), prob.data(), len, xb_ref.data(),
+                           wb_ref.data());
+
+    for (simd::Level lvl :
+         {simd::Level::scalar, simd::Level::avx2, simd::Level::avx512}) {
+      if (simd::detect() < lvl) {
+        if (len == n) {
+          std::fprintf(stderr, "%s: level %d not supported, skipped\n", name,
+                       int(lvl));
+        }
+        continue;
+      }
+      simd::set_level(lvl);
+      KAKUHEN_CHECK(simd::level() == lvl);
+      std::vector<Float> x(len), w(w0.begin(), w0.begin() + len);
+      std::vector<std::uint32_t> bin(len);
+      simd::map_uniform(edges.data(), widths.data(), nb, u.data(), len,
+                        x.data(), bin.data(), w.data());
+      KAKUHEN_CHECK(same(x, x_ref) && same(w, w_ref) && bin == bin_ref);
+
+      std::vector<Float> xb(len), wb(w0.begin(), w0.begin() + len);
+      simd::map_bins(edges.data(), widths.data(), bins.data(), frac.data(),
+                     prob.data(), len, xb.data(), wb.data());
+      KAKUHEN_CHECK(same(xb, xb_ref) && same(wb, wb_ref));
+    }
+  }
+  simd::set_level(simd::detect());
+}
+
+}  // namespace
+
+int main() {
+  check_kernels<double>("double");
+  check_kernels<float>("float");
+  return kakuhen_test::report();
+}
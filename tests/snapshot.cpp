@@ -0,0 +1,113 @@
+// Snapshots round-trip through their binary form (the largest weight
+// included), a corrupt header is rejected before anything is allocated for
+// it, and the weight sketch records only once it is asked for.
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "check.hpp"
+#include "kakuhen/kakuhen.hpp"
+
+namespace {
+
+constexpr std::size_t dim = 3;
+
+double integrand(const std::array<double, dim>& x) {
+  const double a = (x[0] - x[1]) / 0.1;
+  return std::exp(-0.5 * a * a) * (0.5 + x[2]);
+}
+
+kakuhen::Snapshot take_snapshot() {
+  kakuhen::Options opts;
+  opts.n_bins = 16;
+  kakuhen::Integrator<dim> integrator(opts);
+  integrator.iterate(integrand, 5000, false);
+  return integrator.snapshot();
+}
+
+std::string bytes(const kakuhen::Snapshot& s) {
+  std::ostringstream out(std::ios::binary);
+  s.write(out);
+  return out.str();
+}
+
+void check_round_trip() {
+  const kakuhen::Snapshot s = take_snapshot();
+  std::istringstream in(bytes(s), std::ios::binary);
+  const kakuhen::Snapshot r = kakuhen::Snapshot::read(in);
+  KAKUHEN_CHECK(r.compatible(s));
+  KAKUHEN_CHECK(r.sums.sum == s.sums.sum && r.sums.sum2 == s.sums.sum2 &&
+                r.sums.sum_abs == s.sums.sum_abs &&
+                r.sums.max_abs == s.sums.max_abs && r.sums.n == s.sums.n);
+  KAKUHEN_CHECK(s.sums.max_abs > 0.);
+  KAKUHEN_CHECK(r.one == s.one && r.pair == s.pair);
+  KAKUHEN_CHECK(bytes(r) == bytes(s));
+}
+
+/// The largest weight of merged snapshots, e.g. the threshold of
+/// unweighting for a farm of jobs, is that of all their points.
+void check_merged_max_weight() {
+  kakuhen::Options opts;
+  opts.n_bins = 16;
+  kakuhen::Integrator<dim> a(opts);
+  opts.seed = 1;
+  kakuhen::Integrator<dim> b(opts);
+  a.iterate(integrand, 5000, false);
+  b.iterate(integrand, 5000, false);
+  kakuhen::Snapshot merged = a.snapshot();
+  std::istringstream in(bytes(b.snapshot()), std::ios::binary);
+  merged += kakuhen::Snapshot::read(in);
+  KAKUHEN_CHECK(a.max_weight() > 0. && b.max_weight() > 0.);
+  KAKUHEN_CHECK(merged.sums.max_abs ==
+                std::max(a.max_weight(), b.max_weight()));
+}
+
+/// Without `Options::weight_sketch` the sketch stays empty until the first
+/// `weight_quantile`, and records the iterations after it.
+void check_weight_sketch_on_demand() {
+  kakuhen::Options opts;
+  opts.n_bins = 16;
+  kakuhen::Integrator<dim> integrator(opts);
+  integrator.iterate(integrand, 5000, false);
+  KAKUHEN_CHECK(integrator.snapshot().weights.count() == 0);
+  KAKUHEN_CHECK(integrator.weight_quantile(0.5) == 0.);
+  integrator.iterate(integrand, 5000, false);
+  KAKUHEN_CHECK(integrator.snapshot().weights.count() > 0);
+  const double median = integrator.weight_quantile(0.5);
+  KAKUHEN_CHECK(median > 0. && median <= integrator.max_weight());
+}
+
+/// `read` of the snapshot with the header fields n_bins and n_pairs
+/// replaced throws `std::runtime_error`
+bool rejects(std::uint32_t n_bins, std::uint32_t n_pairs) {
+  std::string b = bytes(take_snapshot());
+  // magic, version, byte order, dimension precede n_bins and n_pairs
+  std::memcpy(&b[20], &n_bins, sizeof n_bins);
+  std::memcpy(&b[24], &n_pairs, sizeof n_pairs);
+  std::istringstream in(b, std::ios::binary);
+  try {
+    kakuhen::Snapshot::read(in);
+  } catch (const std::runtime_error&) {
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+int main() {
+  check_round_trip();
+  check_merged_max_weight();
+  check_weight_sketch_on_demand();
+  KAKUHEN_CHECK(rejects(0xffffffffu, 0xffffffffu));
+  KAKUHEN_CHECK(rejects(1u << 20, 1u << 20));
+  // plausible sizes that the stream does not hold are truncated
+  KAKUHEN_CHECK(rejects(64, 1000));
+  return kakuhen_test::report();
+}